@@ -0,0 +1,346 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "SyntheticData.hpp"
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <experimental/filesystem>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <dlib/image_processing.h>
+#include <dlib/rand.h>
+#include <FaceBase/DlibNetworks.hpp>
+#include <FaceBase/FaceLibDlib.hpp>
+#include "misc.hpp"
+#include "ResultStore.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	const float pi = 3.14159265f;
+
+	// Position of the face in a frame: center of the face shape, eye distance in pixels, and rotation in radians
+	struct FacePose
+	{
+		cv::Point2f center;
+		float scale;
+		float angle;
+
+		cv::Point2f transform(const cv::Point2f & p) const
+		{
+			const float c = scale * std::cos(angle), s = scale * std::sin(angle);
+			return cv::Point2f(center.x + c * p.x - s * p.y, center.y + s * p.x + c * p.y);
+		}
+	};
+
+	FacePose face_pose(const SyntheticDatasetParameters & params, long vid_id, long frame_no)
+	{
+		// Smooth movement with a different phase in every video
+		const float t = static_cast<float>(frame_no / params.fps);
+		const float phase = 0.7f * vid_id;
+		FacePose pose;
+		pose.center = cv::Point2f(params.frame_size.width * (0.5f + 0.12f * std::sin(0.8f * t + phase)),
+		                          params.frame_size.height * (0.42f + 0.05f * std::cos(0.6f * t + phase)));
+		pose.scale = 0.16f * params.frame_size.height;
+		pose.angle = 0.12f * std::sin(0.5f * t + phase);
+		return pose;
+	}
+
+	std::vector<std::vector<cv::Point>> polygon(const std::vector<cv::Point2f> & landmarks, int first, int last)
+	{
+		std::vector<std::vector<cv::Point>> points(1);
+		for (int i = first; i <= last; ++i)
+			points[0].push_back(cv::Point(cvRound(landmarks[i].x), cvRound(landmarks[i].y)));
+		return points;
+	}
+
+	int fourcc(char c1, char c2, char c3, char c4)
+	{
+		return (c1 & 255) + ((c2 & 255) << 8) + ((c3 & 255) << 16) + ((c4 & 255) << 24);
+	}
+
+	/// Index of a synthetic video from its filename (e.g. synthetic_0003.mp4 -> 3)
+	long synthetic_video_id(const std::string & filename)
+	{
+		const std::string stem = fs::path(filename).stem().string();
+		const size_t pos = stem.rfind('_');
+		DLIB_CASSERT(pos != std::string::npos && pos + 1 < stem.size(), "Not a synthetic video: " << filename);
+		return std::atol(stem.c_str() + pos + 1);
+	}
+
+	/* Shape predictor with random regression trees. The dimensions are the defaults of dlib's shape_predictor_trainer
+	 * (cascade depth 10, 500 trees per level of depth 4, 400 pixel features), the leaf values are small, so the landmarks
+	 * stay close to the initial shape, i.e., the synthetic face.
+	 */
+	void write_random_shape_predictor(const std::string & filename)
+	{
+		const unsigned long cascade_depth = 10, num_trees_per_cascade_level = 500, tree_depth = 4, feature_pool_size = 400;
+		dlib::rand rnd(31);
+
+		// Initial shape in the normalized face box (see synthetic_face(): box with side 2 centered at (0, 0.25))
+		const std::vector<cv::Point2f> shape = face_shape_68();
+		dlib::matrix<float, 0, 1> initial_shape(2 * shape.size());
+		for (size_t i = 0; i < shape.size(); ++i)
+		{
+			initial_shape(2 * i) = (shape[i].x + 1.0f) / 2.0f;
+			initial_shape(2 * i + 1) = (shape[i].y + 0.75f) / 2.0f;
+		}
+
+		std::vector<std::vector<dlib::impl::regression_tree>> forests(cascade_depth);
+		std::vector<std::vector<dlib::vector<float, 2>>> pixel_coordinates(cascade_depth);
+		for (unsigned long level = 0; level < cascade_depth; ++level)
+		{
+			// Pixel features within the face box
+			for (unsigned long i = 0; i < feature_pool_size; ++i)
+				pixel_coordinates[level].push_back(dlib::vector<float, 2>(rnd.get_random_float(), rnd.get_random_float()));
+
+			forests[level].resize(num_trees_per_cascade_level);
+			for (auto & tree : forests[level])
+			{
+				tree.splits.resize((1ul << tree_depth) - 1);
+				for (auto & split : tree.splits)
+				{
+					split.idx1 = rnd.get_random_32bit_number() % feature_pool_size;
+					split.idx2 = rnd.get_random_32bit_number() % feature_pool_size;
+					split.thresh = (rnd.get_random_float() * 256.0f - 128.0f) / 2.0f;
+				}
+				tree.leaf_values.resize(1ul << tree_depth);
+				for (auto & leaf : tree.leaf_values)
+				{
+					leaf.set_size(initial_shape.size());
+					for (long i = 0; i < leaf.size(); ++i)
+						leaf(i) = (rnd.get_random_float() - 0.5f) * 0.001f;
+				}
+			}
+		}
+
+		dlib::shape_predictor sp(initial_shape, forests, pixel_coordinates);
+		dlib::serialize(filename) << sp;
+	}
+
+	/// Face recognition network with random weights (the layers are initialized by the first forward pass)
+	void write_random_face_recognition_net(const std::string & filename)
+	{
+		dlib_networks::face_rec_net_type net;
+		dlib::matrix<dlib::rgb_pixel> face_chip(150, 150);
+		dlib::assign_all_pixels(face_chip, dlib::rgb_pixel(128, 128, 128));
+		net(face_chip);
+		dlib::serialize(filename) << net;
+	}
+}
+
+std::vector<cv::Point2f> face_shape_68()
+{
+	std::vector<cv::Point2f> shape;
+	// Jaw (0-16)
+	for (int i = 0; i < 17; ++i)
+		shape.push_back(cv::Point2f(-0.95f * std::cos(pi * i / 16), 0.15f + 0.85f * std::sin(pi * i / 16)));
+	// Eyebrows (17-26)
+	for (float x0 : {-0.8f, 0.2f})
+		for (int i = 0; i < 5; ++i)
+			shape.push_back(cv::Point2f(x0 + 0.15f * i, -0.45f + 0.04f * std::abs(i - 2)));
+	// Nose (27-35)
+	for (int i = 0; i < 4; ++i)
+		shape.push_back(cv::Point2f(0.0f, -0.2f + 0.12f * i));
+	for (int i = 0; i < 5; ++i)
+		shape.push_back(cv::Point2f(-0.2f + 0.1f * i, 0.35f + 0.03f * std::abs(i - 2)));
+	// Eyes (36-47)
+	for (float x0 : {-0.5f, 0.5f})
+		for (int i = 0; i < 6; ++i)
+			shape.push_back(cv::Point2f(x0 - 0.15f * std::cos(pi * i / 3), -0.1f - 0.06f * std::sin(pi * i / 3)));
+	// Mouth (48-67)
+	for (int i = 0; i < 12; ++i)
+		shape.push_back(cv::Point2f(-0.35f * std::cos(pi * i / 6), 0.65f - 0.15f * std::sin(pi * i / 6)));
+	for (int i = 0; i < 8; ++i)
+		shape.push_back(cv::Point2f(-0.25f * std::cos(pi * i / 4), 0.65f - 0.07f * std::sin(pi * i / 4)));
+	return shape;
+}
+
+void synthetic_face(const SyntheticDatasetParameters & params, long vid_id, long frame_no, std::vector<cv::Point2f> & landmarks68, dlib::rectangle & box)
+{
+	const FacePose pose = face_pose(params, vid_id, frame_no);
+	landmarks68 = face_shape_68();
+	for (auto & p : landmarks68)
+		p = pose.transform(p);
+
+	// Square box around the face (not rotated)
+	const cv::Point2f box_center = pose.transform(cv::Point2f(0.0f, 0.25f));
+	box = dlib::rectangle(cvRound(box_center.x - pose.scale), cvRound(box_center.y - pose.scale), cvRound(box_center.x + pose.scale), cvRound(box_center.y + pose.scale));
+}
+
+cv::Mat synthetic_frame(const SyntheticDatasetParameters & params, long vid_id, long frame_no)
+{
+	// Smooth background texture of the video
+	cv::RNG rng(1000 + vid_id);
+	cv::Mat texture(params.frame_size.height / 8 + 1, params.frame_size.width / 8 + 1, CV_8UC3), frame;
+	rng.fill(texture, cv::RNG::UNIFORM, 40, 220);
+	cv::resize(texture, frame, params.frame_size, 0, 0, cv::INTER_CUBIC);
+
+	// Face
+	const FacePose pose = face_pose(params, vid_id, frame_no);
+	std::vector<cv::Point2f> landmarks;
+	dlib::rectangle box;
+	synthetic_face(params, vid_id, frame_no, landmarks, box);
+	const cv::Point2f head_center = pose.transform(cv::Point2f(0.0f, 0.2f));
+	const cv::Scalar skin(90 + 10 * (vid_id % 5), 140, 190);
+	const int thickness = std::max(2, cvRound(pose.scale / 15));
+	cv::ellipse(frame, cv::Point(cvRound(head_center.x), cvRound(head_center.y)), cv::Size(cvRound(1.0f * pose.scale), cvRound(0.95f * pose.scale)), pose.angle * 180.0 / pi, 0, 360, skin, -1);
+	cv::polylines(frame, polygon(landmarks, 17, 21), false, cv::Scalar(40, 50, 60), thickness);
+	cv::polylines(frame, polygon(landmarks, 22, 26), false, cv::Scalar(40, 50, 60), thickness);
+	cv::polylines(frame, polygon(landmarks, 27, 30), false, cv::Scalar(60, 90, 130), thickness);
+	cv::polylines(frame, polygon(landmarks, 31, 35), false, cv::Scalar(60, 90, 130), thickness);
+	cv::fillPoly(frame, polygon(landmarks, 36, 41), cv::Scalar(30, 30, 30));
+	cv::fillPoly(frame, polygon(landmarks, 42, 47), cv::Scalar(30, 30, 30));
+	cv::fillPoly(frame, polygon(landmarks, 48, 59), cv::Scalar(70, 60, 170));
+	cv::fillPoly(frame, polygon(landmarks, 60, 67), cv::Scalar(30, 30, 70));
+
+	// Sensor noise, different in every frame
+	cv::RNG frame_rng(static_cast<uint64>(vid_id) << 32 | static_cast<uint64>(frame_no));
+	cv::Mat noise(params.frame_size, CV_8UC3);
+	frame_rng.fill(noise, cv::RNG::UNIFORM, 0, 9);
+	frame += noise;
+	frame -= cv::Scalar::all(4);
+	return frame;
+}
+
+std::string synthetic_video_filename(const SyntheticDatasetParameters & params, const std::string & dataset_dir, long vid_id)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "synthetic_%04ld", vid_id);
+	return dataset_dir + name + params.extension;
+}
+
+void generateSyntheticDataset(const SyntheticDatasetParameters & params, const std::string & dataset_dir, const std::string & exdata_dir, const std::string & train_or_val_or_test)
+{
+	DLIB_CASSERT(params.extension == ".mp4" || params.extension == ".avi", "Unsupported video format: " << params.extension);
+	fs::create_directories(dataset_dir);
+	fs::create_directories(exdata_dir);
+
+	std::ofstream filename_list(exdata_dir + train_or_val_or_test + "_filenames.txt");
+	for (long vid_id = 0; vid_id < params.num_videos; ++vid_id)
+	{
+		const std::string filename = synthetic_video_filename(params, dataset_dir, vid_id);
+		cv::VideoWriter writer(filename, params.extension == ".mp4" ? fourcc('m', 'p', '4', 'v') : fourcc('M', 'J', 'P', 'G'), params.fps, params.frame_size);
+		DLIB_CASSERT(writer.isOpened(), "Cannot write video " << filename << " (is OpenCV built with video support?)");
+		for (long frame_no = 0; frame_no < params.num_frames; ++frame_no)
+			writer << synthetic_frame(params, vid_id, frame_no);
+		filename_list << filename << '\n';
+	}
+	filename_list.close();
+	DLIB_CASSERT(!filename_list.fail(), "Cannot write the filename list to " << exdata_dir);
+
+	writeSyntheticFaceDetections(params, exdata_dir, train_or_val_or_test);
+	writeSyntheticModels(exdata_dir);
+}
+
+void writeSyntheticFaceDetections(const SyntheticDatasetParameters & params, const std::string & exdata_dir, const std::string & train_or_val_or_test)
+{
+	const std::string filename_list_filename = exdata_dir + train_or_val_or_test + "_filenames.txt";
+	const std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.bin";
+
+	std::vector<std::string> filename_list;
+	misc::read_filename_list(filename_list_filename, filename_list);
+
+	ResultStoreWriter writer(filename_face_detection, filename_list.size(), face_detection_columns());
+	DLIB_CASSERT(writer.is_open(), "Cannot write face detections to " << filename_face_detection);
+	std::vector<cv::Point2f> landmarks;
+	dlib::rectangle det;
+	for (size_t i = 0; i < filename_list.size(); ++i)
+	{
+		const long vid_id = synthetic_video_id(filename_list[i]);
+		ResultVideo video(face_detection_columns());
+		for (long frame_no = 0; frame_no < params.num_frames; ++frame_no)
+		{
+			synthetic_face(params, vid_id, frame_no, landmarks, det);
+			const int32_t box[4] = { int32_t(det.left()), int32_t(det.top()), int32_t(det.width()), int32_t(det.height()) };
+			video.append(0, box);
+		}
+		writer.write(i, std::move(video));
+	}
+	DLIB_CASSERT(writer.close(), "Error writing face detections to " << filename_face_detection);
+}
+
+void writeSyntheticModels(const std::string & exdata_dir)
+{
+	// Same filenames as in detectAUsOld() and recognizeFaces()
+	const std::string feature_model_file = exdata_dir + "lbp_10_10_8_1.txt";
+	const std::string mean_std_file = exdata_dir + "Features_mean_std_disfa.txt";
+	const std::string regressor_file = exdata_dir + "Regression_model_disfa_1_2_4_6_9_12_25.txt";
+	const std::string mean_shape_file = exdata_dir + "mean_face_shape_intraface.dat";
+	const std::string shape_predictor_file = exdata_dir + "spd+all=cascade30+oversampling70+trees1500.dat";
+	const std::string face_recognition_file = exdata_dir + "dlib_face_recognition_resnet_model_v1.dat";
+
+	if (!fs::exists(feature_model_file) || !fs::exists(mean_std_file) || !fs::exists(regressor_file))
+		DLIB_CASSERT(write_AU_model(feature_model_file, mean_std_file, regressor_file), "Cannot write the AU model to " << exdata_dir);
+	if (!fs::exists(mean_shape_file))
+		DLIB_CASSERT(write_mean_shape(mean_shape_file), "Cannot write " << mean_shape_file);
+	if (!fs::exists(shape_predictor_file))
+		write_random_shape_predictor(shape_predictor_file);
+	if (!fs::exists(face_recognition_file))
+		write_random_face_recognition_net(face_recognition_file);
+}
+
+bool write_AU_model(const std::string & feature_model_file, const std::string & mean_std_file, const std::string & regressor_file)
+{
+	// 10x10 blocks of uniform LBP with 8 neighbors and radius 1, 49 landmarks, 7 AUs
+	const int num_blocks = 10, num_bins = 59, num_landmarks = 49;
+	const int num_feat = 2 * num_landmarks + num_blocks * num_blocks * num_bins;
+	const int AU_ids[] = {1, 2, 4, 6, 9, 12, 25};
+	const int num_AUs = sizeof(AU_ids) / sizeof(AU_ids[0]);
+	cv::RNG rng(17);
+
+	// Uniform LBP mapping: the 58 patterns with at most 2 bit transitions get their own bin, all others the last one
+	std::ofstream feature_model(feature_model_file);
+	feature_model << num_blocks << " " << num_blocks << " 8 1\n8 " << num_bins << "\n";
+	int next_bin = 0;
+	for (int code = 0; code < 256; ++code)
+	{
+		const int rotated = ((code << 1) | (code >> 7)) & 255;
+		int transitions = 0;
+		for (int diff = code ^ rotated; diff; diff >>= 1)
+			transitions += diff & 1;
+		feature_model << (transitions <= 2 ? next_bin++ : num_bins - 1) << " ";
+	}
+	feature_model << "\n";
+	for (int code = 0; code < 256; ++code)
+		feature_model << "0 ";
+	feature_model << "\n";
+
+	std::ofstream mean_std(mean_std_file);
+	mean_std << num_feat << "\n";
+	for (int i = 0; i < num_feat; ++i)
+		mean_std << rng.uniform(0.0f, 100.0f) << " ";
+	mean_std << "\n" << num_feat << "\n";
+	for (int i = 0; i < num_feat; ++i)
+		mean_std << rng.uniform(1.0f, 50.0f) << " ";
+	mean_std << "\n";
+
+	std::ofstream regressor(regressor_file);
+	regressor << num_AUs << "\n";
+	for (int au = 0; au < num_AUs; ++au)
+		regressor << AU_ids[au] << " ";
+	regressor << "\n";
+	for (int au = 0; au < num_AUs; ++au)
+		regressor << rng.uniform(-1.0f, 1.0f) << " ";
+	regressor << "\n" << num_feat << "\n";
+	for (int i = 0; i < num_feat * num_AUs; ++i)
+		regressor << rng.uniform(-0.01f, 0.01f) << " ";
+	regressor << "\n";
+
+	return bool(feature_model) && bool(mean_std) && bool(regressor);
+}
+
+bool write_mean_shape(const std::string & filename)
+{
+	std::vector<cv::Point2f> mean_shape;
+	FaceLibDlib::conv_landmarks_68_to_49(face_shape_68(), mean_shape);
+	std::ofstream file(filename);
+	for (const auto & p : mean_shape)
+		file << p.x << "\t" << p.y << "\t";
+	return bool(file);
+}
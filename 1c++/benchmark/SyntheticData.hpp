@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <dlib/geometry.h>
+
+/* Deterministic synthetic data for the benchmarks, so they run without the challenge videos and the exdata bundle.
+ * The videos show a drawn face (with the landmark layout of face_shape_68()) that moves and turns slightly in front of
+ * a textured background. Its face box is known for every frame, so the face detections are generated instead of detected.
+ * The models (AU estimation, mean shape, shape predictor, face recognition network) have the dimensions of the real ones
+ * but random values, so the run times are representative while the results are meaningless.
+ */
+struct SyntheticDatasetParameters
+{
+	long num_videos = 12;			// recognizeFaces() clusters the videos in groups of 12
+	long num_frames = 300;			// Frames per video
+	cv::Size frame_size = cv::Size(640, 480);
+	std::string extension = ".mp4";		// ".mp4" (MPEG-4) or ".avi" (Motion JPEG)
+	double fps = 25.0;
+};
+
+/// 68 landmarks (dlib / iBUG order) of the synthetic face, centered at (0, 0) with an eye distance of 1
+std::vector<cv::Point2f> face_shape_68();
+
+/// Landmarks and face box of the synthetic face in frame frame_no of video vid_id
+void synthetic_face(const SyntheticDatasetParameters & params, long vid_id, long frame_no, std::vector<cv::Point2f> & landmarks68, dlib::rectangle & box);
+
+/// Color frame frame_no of video vid_id
+cv::Mat synthetic_frame(const SyntheticDatasetParameters & params, long vid_id, long frame_no);
+
+/// Filename of video vid_id in dataset_dir (e.g. synthetic_0003.mp4)
+std::string synthetic_video_filename(const SyntheticDatasetParameters & params, const std::string & dataset_dir, long vid_id);
+
+/* Write the videos to dataset_dir and the filename list (xxx_filenames.txt), face detections (xxx_facedet.bin), and the
+ * models that do not exist yet to exdata_dir (xxx = train_or_val_or_test). Real models copied to exdata_dir are kept.
+ */
+void generateSyntheticDataset(const SyntheticDatasetParameters & params, const std::string & dataset_dir, const std::string & exdata_dir, const std::string & train_or_val_or_test);
+
+/// Write the face detections (xxx_facedet.bin) of the videos in the filename list (in its order, e.g. after createFileNameList())
+void writeSyntheticFaceDetections(const SyntheticDatasetParameters & params, const std::string & exdata_dir, const std::string & train_or_val_or_test);
+
+/// Write the models of detectAUsOld() and recognizeFaces() with random values to exdata_dir (existing files are kept)
+void writeSyntheticModels(const std::string & exdata_dir);
+
+/// Text model files of the AU estimation with the dimensions of the shipped model and random values
+bool write_AU_model(const std::string & feature_model_file, const std::string & mean_std_file, const std::string & regressor_file);
+
+/// Mean shape file of the face registration (49 inner landmarks of face_shape_68())
+bool write_mean_shape(const std::string & filename);
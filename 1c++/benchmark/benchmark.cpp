@@ -0,0 +1,822 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+/* Benchmarks of the feature extraction with synthetic data (see SyntheticData.hpp), so no dataset or exdata files are needed.
+ * 1. Micro benchmarks of the hot paths (default): Every benchmark is run once before the measurement (so buffers reach
+ *    their final size) and then repeated until --min-time seconds are reached. The time, throughput, and heap allocations
+ *    per operation are printed as a table and written as JSON with --json FILE, so different builds can be compared.
+ * 2. End-to-end benchmark (--e2e DIR): createFileNameList(), detectAUsOld(), and recognizeFaces() run on synthetic videos
+ *    of configurable number, length, and resolution. The frames/sec and peak memory of each stage are reported.
+ * 3. Checks (--check): Results of the optimized AU estimation compared to the reference code and allocations with a
+ *    workspace, see runChecks().
+ * See help() for the options.
+ */
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cerrno>
+#include <algorithm>
+#include <experimental/filesystem>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <ActionUnitIntensityEstimation/AU.hpp>
+#include <FaceBase/FaceRegistrationAffineMeanShape.hpp>
+#include <FaceBase/FaceLibDlib.hpp>
+#include <BinaryFile/BinaryFile.hpp>
+#include "misc.hpp"
+#include "ResultStore.hpp"
+#include "ExtractionOptions.hpp"
+#include "Profiler.hpp"
+#include "SyntheticData.hpp"
+
+// Defined in FaceRegistrationAffineMeanShape.cpp
+cv::Mat estimateAffineTransform(const std::vector<cv::Point2f> & src, const std::vector<cv::Point2f> & dst);
+cv::Mat estimateAffineTransformClosedForm(const std::vector<cv::Point2f> & src, const std::vector<cv::Point2f> & dst, const cv::Point2d & dst_center);
+// Stages of the extraction (see main.cpp)
+void createFileNameList(const std::string& dataset_dir, const std::string& exdata_dir, const std::string& train_or_val_or_test);
+void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options);
+void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options);
+
+namespace fs = std::experimental::filesystem;
+
+/* Heap allocations are counted by replacing malloc and friends of glibc (operator new and the OpenCV allocator use them).
+ * The counters include all threads, the benchmarks are single threaded. On other platforms, no allocations are counted.
+ */
+#if defined(__GLIBC__)
+#define COUNT_ALLOCATIONS 1
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * __libc_calloc(size_t n, size_t size);
+extern "C" void * __libc_realloc(void * ptr, size_t size);
+extern "C" void * __libc_memalign(size_t alignment, size_t size);
+#endif
+
+namespace
+{
+	std::atomic<size_t> num_allocations(0);
+	std::atomic<size_t> num_allocated_bytes(0);
+
+	inline void count_allocation(size_t size)
+	{
+		num_allocations.fetch_add(1, std::memory_order_relaxed);
+		num_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+#ifdef COUNT_ALLOCATIONS
+extern "C" void * malloc(size_t size) __THROW
+{
+	count_allocation(size);
+	return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t n, size_t size) __THROW
+{
+	count_allocation(n * size);
+	return __libc_calloc(n, size);
+}
+
+extern "C" void * realloc(void * ptr, size_t size) __THROW
+{
+	count_allocation(size);
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void * memalign(size_t alignment, size_t size) __THROW
+{
+	count_allocation(size);
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void ** ptr, size_t alignment, size_t size) __THROW
+{
+	count_allocation(size);
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr || size == 0 ? 0 : ENOMEM;
+}
+#endif
+
+// Access to the feature extraction steps of the AU estimation (friend of AUIntensityEstimation)
+class AUIntensityEstimationBenchmark
+{
+public:
+	static bool lbp(const AUIntensityEstimation & AU, const cv::Mat & block, cv::Mat & feature)
+	{
+		return AU.lbp(block, feature);
+	}
+
+	static bool extract_features(const AUIntensityEstimation & AU, const cv::Mat & image_registered, cv::Mat & features)
+	{
+		return AU.extract_features(image_registered, features);
+	}
+
+	static bool uses_folded_model(const AUIntensityEstimation & AU)
+	{
+		return AU.use_folded_model();
+	}
+
+	/// Use the generic LBP code (as for models other than 8 neighbors / radius 1)
+	static void use_generic_lbp(AUIntensityEstimation & AU)
+	{
+		AU.m_lbp_kernel = AUIntensityEstimation::LBP_KERNEL_GENERIC;
+		AU.m_lbp_row_kernel = 0;
+	}
+};
+
+namespace
+{
+	typedef std::chrono::steady_clock steady_clock;
+
+	struct Result
+	{
+		std::string name;
+		std::string unit;	// Unit of the items processed per operation (e.g. frames, bytes)
+		long iterations;
+		double seconds;
+		double items_per_op;
+		double allocations;	// Per operation, negative if not counted
+		double allocated_bytes;
+	};
+
+	class Benchmarks
+	{
+	public:
+		std::string filter;
+		double min_time = 0.5;
+		std::vector<Result> results;
+
+		/// Measure fn(), which processes items_per_op items of the given unit
+		template<typename F>
+		void run(const std::string & name, double items_per_op, const char * unit, F fn)
+		{
+			if (!filter.empty() && name.find(filter) == std::string::npos)
+				return;
+
+			// Warm-up, e.g. the output matrices and workspaces get their final size
+			fn();
+
+			long iterations = 1;
+			for (;;)
+			{
+				const size_t allocations_start = num_allocations;
+				const size_t bytes_start = num_allocated_bytes;
+				const steady_clock::time_point start = steady_clock::now();
+				for (long i = 0; i < iterations; ++i)
+					fn();
+				const double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+				const size_t allocations = num_allocations - allocations_start;
+				const size_t bytes = num_allocated_bytes - bytes_start;
+
+				if (seconds >= min_time || iterations >= (1l << 30))
+				{
+					Result result;
+					result.name = name;
+					result.unit = unit;
+					result.iterations = iterations;
+					result.seconds = seconds;
+					result.items_per_op = items_per_op;
+#ifdef COUNT_ALLOCATIONS
+					result.allocations = double(allocations) / iterations;
+					result.allocated_bytes = double(bytes) / iterations;
+#else
+					result.allocations = result.allocated_bytes = -1.0;
+#endif
+					print(result);
+					results.push_back(result);
+					return;
+				}
+
+				// Aim at 1.2 times the minimum time, but grow at most by a factor of 100 per step
+				const double factor = seconds > 0.0 ? 1.2 * min_time / seconds : 100.0;
+				iterations = std::min(std::max(iterations + 1, long(iterations * std::min(factor, 100.0))), 1l << 30);
+			}
+		}
+
+		bool write_json(const std::string & filename) const
+		{
+			std::ofstream file(filename);
+			if (!file.is_open())
+				return false;
+
+#ifdef __VERSION__
+			const char * compiler = __VERSION__;
+#else
+			const char * compiler = "unknown";
+#endif
+#ifdef COUNT_ALLOCATIONS
+			const char * allocations_counted = "true";
+#else
+			const char * allocations_counted = "false";
+#endif
+			file << "{\"compiler\": \"" << compiler << "\", \"opencv\": \"" << CV_VERSION << "\", \"allocations_counted\": " << allocations_counted
+			     << ",\n \"benchmarks\": [";
+			for (size_t i = 0; i < results.size(); ++i)
+			{
+				const Result & r = results[i];
+				const double ns_per_op = 1e9 * r.seconds / r.iterations;
+				file << (i ? "," : "") << "\n  {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << ns_per_op
+				     << ", \"items_per_op\": " << r.items_per_op << ", \"unit\": \"" << r.unit << "\", \"items_per_second\": " << r.items_per_op * 1e9 / ns_per_op
+				     << ", \"allocations_per_op\": " << r.allocations << ", \"allocated_bytes_per_op\": " << r.allocated_bytes << "}";
+			}
+			file << "\n]}\n";
+			file.close();
+			return !file.fail();
+		}
+
+	private:
+		static void print(const Result & r)
+		{
+			const double us_per_op = 1e6 * r.seconds / r.iterations;
+			std::cout << std::left << std::setw(44) << r.name << std::right << std::setw(12) << std::fixed << std::setprecision(3) << us_per_op << " us/op"
+			          << std::setw(14) << std::setprecision(1) << r.items_per_op * 1e6 / us_per_op << " " << std::left << std::setw(8) << r.unit << "/s" << std::right;
+			if (r.allocations >= 0)
+				std::cout << std::setw(10) << std::setprecision(1) << r.allocations << " allocs/op" << std::setw(12) << std::setprecision(0) << r.allocated_bytes << " bytes/op";
+			std::cout << std::endl;
+		}
+	};
+
+	/// Face detections of num_videos videos with num_frames frames each, as binary result store and text file
+	bool write_face_detections(const std::string & store_filename, const std::string & csv_filename, long num_videos, long num_frames)
+	{
+		cv::RNG rng(23);
+		ResultStoreWriter writer(store_filename, num_videos, face_detection_columns());
+		for (long vid_id = 0; vid_id < num_videos; ++vid_id)
+		{
+			ResultVideo video(face_detection_columns());
+			for (long frame_no = 0; frame_no < num_frames; ++frame_no)
+			{
+				const int32_t box[4] = { rng.uniform(0, 400), rng.uniform(0, 200), rng.uniform(100, 240), rng.uniform(100, 240) };
+				video.append(0, box);
+			}
+			writer.write(vid_id, std::move(video));
+		}
+		return writer.close() && export_result_csv(store_filename, csv_filename);
+	}
+
+	/* Peak resident set size (VmHWM) of the process in kB, -1 if not available. It can be reset (Linux 4.0 or newer),
+	 * so the peak of each stage is measured separately.
+	 */
+	bool reset_peak_rss()
+	{
+		std::ofstream file("/proc/self/clear_refs");
+		file << "5";
+		file.close();
+		return !file.fail();
+	}
+
+	long peak_rss_kb()
+	{
+		std::ifstream file("/proc/self/status");
+		std::string line;
+		while (std::getline(file, line))
+			if (line.compare(0, 6, "VmHWM:") == 0)
+				return std::atol(line.c_str() + 6);
+		return -1;
+	}
+
+	struct BenchmarkOptions
+	{
+		std::string filter;
+		double min_time = 0.5;
+		std::string json_file;
+
+		// Only run the checks of the AU estimation (--check)
+		bool check = false;
+
+		// End-to-end benchmark (--e2e) or only the generation of the synthetic dataset (--generate) in directory dir
+		bool end_to_end = false;
+		bool generate = false;
+		std::string dir;
+		SyntheticDatasetParameters dataset;
+		long jobs = 1;
+		std::string profile_file;
+	};
+
+	bool parseOptions(int argc, char **argv, BenchmarkOptions & options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = std::string(argv[i]);
+			if (arg == "--filter" && i + 1 < argc)
+				options.filter = std::string(argv[++i]);
+			else if (arg == "--min-time" && i + 1 < argc)
+				options.min_time = std::atof(argv[++i]);
+			else if (arg == "--json" && i + 1 < argc)
+				options.json_file = std::string(argv[++i]);
+			else if (arg == "--check")
+				options.check = true;
+			else if ((arg == "--e2e" || arg == "--generate") && i + 1 < argc)
+			{
+				options.end_to_end = arg == "--e2e";
+				options.generate = arg == "--generate";
+				options.dir = std::string(argv[++i]);
+				if (options.dir.back() != '/')
+					options.dir.push_back('/');
+			}
+			else if (arg == "--videos" && i + 1 < argc)
+			{
+				options.dataset.num_videos = std::atol(argv[++i]);
+				if (options.dataset.num_videos < 12)
+				{
+					std::cout << "Error: --videos requires at least 12 videos (recognizeFaces() clusters groups of 12)" << std::endl;
+					return false;
+				}
+			}
+			else if (arg == "--frames" && i + 1 < argc)
+			{
+				options.dataset.num_frames = std::atol(argv[++i]);
+				if (options.dataset.num_frames < 1)
+				{
+					std::cout << "Error: --frames requires a positive number" << std::endl;
+					return false;
+				}
+			}
+			else if (arg == "--size" && i + 1 < argc)
+			{
+				int width = 0, height = 0;
+				if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width < 64 || height < 64)
+				{
+					std::cout << "Error: --size requires the frame size as WIDTHxHEIGHT (at least 64x64)" << std::endl;
+					return false;
+				}
+				options.dataset.frame_size = cv::Size(width, height);
+			}
+			else if (arg == "--format" && i + 1 < argc)
+			{
+				options.dataset.extension = "." + std::string(argv[++i]);
+				if (options.dataset.extension != ".mp4" && options.dataset.extension != ".avi")
+				{
+					std::cout << "Error: --format must be mp4 or avi" << std::endl;
+					return false;
+				}
+			}
+			else if (arg == "--jobs" && i + 1 < argc)
+			{
+				options.jobs = std::atol(argv[++i]);
+				if (options.jobs < 1)
+				{
+					std::cout << "Error: --jobs requires a positive number" << std::endl;
+					return false;
+				}
+			}
+			else if (arg == "--profile" && i + 1 < argc)
+				options.profile_file = std::string(argv[++i]);
+			else
+			{
+				std::cout << "Error: Unknown option " << arg << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int help()
+{
+	std::cout << std::endl;
+	std::cout << "usage: ICCV17Benchmark [options]" << std::endl;
+	std::cout << "Runs the micro benchmarks of the hot paths, or with --e2e the extraction stages on a synthetic dataset." << std::endl;
+	std::cout << "options:" << std::endl;
+	std::cout << "  --filter NAME: Run only the micro benchmarks whose name contains NAME (e.g. au/)." << std::endl;
+	std::cout << "  --min-time SECONDS: Minimum measurement time of each micro benchmark (default: 0.5)." << std::endl;
+	std::cout << "  --json FILE: Write the results as JSON to FILE." << std::endl;
+	std::cout << "  --check: Instead of the benchmarks, check that the AU estimation with the normalization folded into the regression model gives the same results as the unfolded model, and that estimate() and estimate_batch() do not allocate memory when called again with the same workspace. Returns non-zero if a check fails." << std::endl;
+	std::cout << "  --e2e DIR: Run createFileNameList(), detectAUsOld(), and recognizeFaces() on a synthetic dataset in DIR (generated if needed, see --generate) and report frames/sec and peak memory of each stage." << std::endl;
+	std::cout << "  --generate DIR: Only write the synthetic videos to DIR/dataset, and their filename list, face detections, and models with random values to DIR/exdata (name: synthetic). Models that exist in DIR/exdata (e.g. copied from the real exdata folder) are kept." << std::endl;
+	std::cout << "  --videos N: Number of synthetic videos (default: 12, at least 12)." << std::endl;
+	std::cout << "  --frames N: Frames per synthetic video (default: 300)." << std::endl;
+	std::cout << "  --size WxH: Frame size of the synthetic videos (default: 640x480)." << std::endl;
+	std::cout << "  --format {mp4, avi}: Video format of the synthetic videos, MPEG-4 or Motion JPEG (default: mp4)." << std::endl;
+	std::cout << "  --jobs N: With --e2e, process N videos in parallel (default: 1)." << std::endl;
+	std::cout << "  --profile FILE: With --e2e, write the time of the sections of each stage as JSON (see Profiler.hpp)." << std::endl;
+	std::cout << std::endl;
+	return -1;
+}
+
+/* Checks of the AU estimation on the synthetic model and a synthetic registered face:
+ * 1. The folded model (see AUIntensityEstimation::set_fold_normalization()) must give the same AU intensities as the unfolded one.
+ * 2. estimate() and estimate_batch() must not allocate memory when called again with the same workspace (glibc only).
+ */
+int runChecks()
+{
+	const fs::path tmp_dir = fs::temp_directory_path() / ("ICCV17Benchmark_" + std::to_string(steady_clock::now().time_since_epoch().count()));
+	fs::create_directories(tmp_dir);
+	const std::string feature_model_file = (tmp_dir / "lbp_10_10_8_1.txt").string();
+	const std::string mean_std_file = (tmp_dir / "Features_mean_std.txt").string();
+	const std::string regressor_file = (tmp_dir / "Regression_model.txt").string();
+	const std::string mean_shape_file = (tmp_dir / "mean_face_shape.dat").string();
+
+	int failed = 0;
+	auto check = [&failed](bool okay, const std::string & name)
+	{
+		std::cout << (okay ? "passed: " : "FAILED: ") << name << std::endl;
+		if (!okay)
+			++failed;
+	};
+
+	try
+	{
+		CV_Assert(write_AU_model(feature_model_file, mean_std_file, regressor_file));
+		CV_Assert(write_mean_shape(mean_shape_file));
+
+		// Registered face as in detectAUsOld()
+		const SyntheticDatasetParameters params;
+		const cv::Mat frame = synthetic_frame(params, 0, 0);
+		std::vector<cv::Point2f> landmarks68, landmarks49, landmarks49_registered;
+		dlib::rectangle face_box;
+		synthetic_face(params, 0, 0, landmarks68, face_box);
+		FaceLibDlib::conv_landmarks_68_to_49(landmarks68, landmarks49);
+		FaceRegistrationAffineMeanShape face_reg;
+		CV_Assert(face_reg.init(mean_shape_file.c_str(), cv::Size(200, 200), 0.5));
+		cv::Mat face_registered;
+		face_reg.register_face(landmarks49, frame, &face_registered, &landmarks49_registered);
+
+		AUIntensityEstimation AU;
+		CV_Assert(AU.init(feature_model_file, mean_std_file, regressor_file));
+		AUIntensityEstimation AU_unfolded = AU;
+		AU_unfolded.set_fold_normalization(false);
+		check(AUIntensityEstimationBenchmark::uses_folded_model(AU) && !AUIntensityEstimationBenchmark::uses_folded_model(AU_unfolded), "au/fold_normalization (model folded)");
+
+		// Same results up to float rounding
+		auto equal = [](const cv::Mat & a, const cv::Mat & b)
+		{
+			if (a.size() != b.size() || a.type() != CV_32FC1 || b.type() != CV_32FC1)
+				return false;
+			for (int i = 0; i < a.rows; ++i)
+				for (int j = 0; j < a.cols; ++j)
+				{
+					const float x = a.at<float>(i, j), y = b.at<float>(i, j);
+					if (!(std::abs(x - y) <= 1e-4f * std::max(1.0f, std::abs(x))))
+						return false;
+				}
+			return true;
+		};
+
+		cv::Mat AU_intensities, AU_intensities_unfolded;
+		CV_Assert(AU.estimate(face_registered, landmarks49_registered, AU_intensities));
+		CV_Assert(AU_unfolded.estimate(face_registered, landmarks49_registered, AU_intensities_unfolded));
+		check(equal(AU_intensities, AU_intensities_unfolded), "au/estimate (folded == unfolded)");
+
+		const int batch_size = 32;
+		const std::vector<cv::Mat> faces_registered(batch_size, face_registered);
+		const std::vector<std::vector<cv::Point2f>> landmarks49_registered_batch(batch_size, landmarks49_registered);
+		CV_Assert(AU.estimate_batch(faces_registered, landmarks49_registered_batch, AU_intensities));
+		CV_Assert(AU_unfolded.estimate_batch(faces_registered, landmarks49_registered_batch, AU_intensities_unfolded));
+		check(equal(AU_intensities, AU_intensities_unfolded), "au/estimate_batch (folded == unfolded)");
+
+#ifdef COUNT_ALLOCATIONS
+		// The first call may allocate the output matrix, the second one must not allocate anything
+		AUIntensityEstimation::Workspace AU_workspace;
+		CV_Assert(AU.init_workspace(AU_workspace, face_registered.size(), batch_size));
+		auto no_allocations = [](std::function<bool()> fn)
+		{
+			CV_Assert(fn());
+			const size_t allocations_start = num_allocations;
+			CV_Assert(fn());
+			return num_allocations == allocations_start;
+		};
+		check(no_allocations([&]() { return AU.estimate(face_registered, landmarks49_registered, AU_intensities, AU_workspace); }), "au/estimate (no allocations with workspace)");
+		check(no_allocations([&]() { return AU.estimate_batch(faces_registered, landmarks49_registered_batch, AU_intensities, AU_workspace); }), "au/estimate_batch (no allocations with workspace)");
+#else
+		std::cout << "skipped: au/estimate and au/estimate_batch (no allocations with workspace), allocations are counted with glibc only" << std::endl;
+#endif
+	}
+	catch (std::exception& e)
+	{
+		std::cout << e.what() << std::endl;
+		++failed;
+	}
+
+	std::error_code ec;
+	fs::remove_all(tmp_dir, ec);
+	return failed ? -1 : 0;
+}
+
+int runMicroBenchmarks(const BenchmarkOptions & options)
+{
+	Benchmarks benchmarks;
+	benchmarks.filter = options.filter;
+	benchmarks.min_time = options.min_time;
+	const std::string & json_file = options.json_file;
+
+	// Synthetic model files in a temporary directory
+	const fs::path tmp_dir = fs::temp_directory_path() / ("ICCV17Benchmark_" + std::to_string(steady_clock::now().time_since_epoch().count()));
+	fs::create_directories(tmp_dir);
+	const std::string feature_model_file = (tmp_dir / "lbp_10_10_8_1.txt").string();
+	const std::string mean_std_file = (tmp_dir / "Features_mean_std.txt").string();
+	const std::string regressor_file = (tmp_dir / "Regression_model.txt").string();
+	const std::string mean_shape_file = (tmp_dir / "mean_face_shape.dat").string();
+	const std::string detections_store_file = (tmp_dir / "facedet.bin").string();
+	const std::string detections_csv_file = (tmp_dir / "facedet.txt").string();
+	const long num_videos = 20, num_frames = 500;
+
+	int result = 0;
+	try
+	{
+		CV_Assert(write_AU_model(feature_model_file, mean_std_file, regressor_file));
+		CV_Assert(write_mean_shape(mean_shape_file));
+		CV_Assert(write_face_detections(detections_store_file, detections_csv_file, num_videos, num_frames));
+
+		// Frame and landmarks as in detectAUsOld()
+		const SyntheticDatasetParameters params;
+		const cv::Mat frame = synthetic_frame(params, 0, 0);
+		std::vector<cv::Point2f> landmarks68, landmarks49;
+		dlib::rectangle face_box;
+		synthetic_face(params, 0, 0, landmarks68, face_box);
+		FaceLibDlib::conv_landmarks_68_to_49(landmarks68, landmarks49);
+
+		// 1. Landmarks and face registration
+		benchmarks.run("landmarks/conv_landmarks_68_to_49", 1, "faces", [&]()
+		{
+			FaceLibDlib::conv_landmarks_68_to_49(landmarks68, landmarks49);
+		});
+
+		FaceRegistrationAffineMeanShape face_reg;
+		CV_Assert(face_reg.init(mean_shape_file.c_str(), cv::Size(200, 200), 0.5));
+		std::vector<cv::Point2f> landmarks49_registered;
+		cv::Mat face_registered, face_registered_gray, transform;
+
+		// Mean shape in the registered face (as in FaceRegistrationAffineMeanShape::init())
+		std::vector<cv::Point2f> mean_shape;
+		FaceLibDlib::conv_landmarks_68_to_49(face_shape_68(), mean_shape);
+		cv::Point2d mean_shape_center(0, 0);
+		for (auto & p : mean_shape)
+		{
+			p = cv::Point2f(p.x * 100.0f + 100.0f, p.y * 100.0f + 100.0f);
+			mean_shape_center += cv::Point2d(p.x, p.y) * (1.0 / mean_shape.size());
+		}
+
+		benchmarks.run("registration/estimateAffineTransform", 1, "faces", [&]()
+		{
+			transform = estimateAffineTransform(landmarks49, mean_shape);
+		});
+		benchmarks.run("registration/estimateAffineTransformClosedForm", 1, "faces", [&]()
+		{
+			transform = estimateAffineTransformClosedForm(landmarks49, mean_shape, mean_shape_center);
+		});
+		benchmarks.run("registration/register_face", 1, "faces", [&]()
+		{
+			face_reg.register_face(landmarks49, frame, &face_registered, &landmarks49_registered);
+		});
+		benchmarks.run("registration/register_face_gray", 1, "faces", [&]()
+		{
+			face_reg.register_face_gray(landmarks49, frame, face_registered_gray, &landmarks49_registered);
+		});
+		face_reg.register_face(landmarks49, frame, &face_registered, &landmarks49_registered);
+
+		// 2. AU estimation
+		AUIntensityEstimation AU;
+		CV_Assert(AU.init(feature_model_file, mean_std_file, regressor_file));
+		AUIntensityEstimation AU_generic = AU;
+		AUIntensityEstimationBenchmark::use_generic_lbp(AU_generic);
+		AUIntensityEstimation::Workspace AU_workspace;
+		CV_Assert(AU.init_workspace(AU_workspace, face_registered.size()));
+		cv::Mat features, AU_intensities;
+
+		// One block of the generic feature extraction (grayscale face divided by 256)
+		cv::Mat face_gray;
+		cv::cvtColor(face_registered, face_gray, CV_BGR2GRAY);
+		face_gray.convertTo(face_gray, CV_64FC1, 1.0 / 256.0);
+		const cv::Mat block = face_gray(cv::Rect(0, 0, 20, 20)).clone();
+		benchmarks.run("au/lbp (20x20 block)", 1, "blocks", [&]()
+		{
+			AUIntensityEstimationBenchmark::lbp(AU, block, features);
+		});
+		benchmarks.run("au/extract_features", 1, "faces", [&]()
+		{
+			AUIntensityEstimationBenchmark::extract_features(AU, face_registered, features);
+		});
+		benchmarks.run("au/extract_features (generic lbp)", 1, "faces", [&]()
+		{
+			AUIntensityEstimationBenchmark::extract_features(AU_generic, face_registered, features);
+		});
+		// The workspace variants must not allocate memory after the first frame
+		benchmarks.run("au/estimate", 1, "faces", [&]()
+		{
+			AU.estimate(face_registered, landmarks49_registered, AU_intensities, AU_workspace);
+		});
+		benchmarks.run("au/estimate (no workspace)", 1, "faces", [&]()
+		{
+			AU.estimate(face_registered, landmarks49_registered, AU_intensities);
+		});
+		benchmarks.run("au/estimate (generic lbp)", 1, "faces", [&]()
+		{
+			AU_generic.estimate(face_registered, landmarks49_registered, AU_intensities, AU_workspace);
+		});
+
+		const int batch_size = 32;
+		const std::vector<cv::Mat> faces_registered(batch_size, face_registered);
+		const std::vector<std::vector<cv::Point2f>> landmarks49_registered_batch(batch_size, landmarks49_registered);
+		AUIntensityEstimation::Workspace AU_batch_workspace;
+		CV_Assert(AU.init_workspace(AU_batch_workspace, face_registered.size(), batch_size));
+		benchmarks.run("au/estimate_batch (32 faces)", batch_size, "faces", [&]()
+		{
+			AU.estimate_batch(faces_registered, landmarks49_registered_batch, AU_intensities, AU_batch_workspace);
+		});
+
+		for (auto quantization : {AUIntensityEstimation::QUANTIZATION_INT16, AUIntensityEstimation::QUANTIZATION_INT8})
+		{
+			AUIntensityEstimation AU_quantized = AU;
+			if (!AU_quantized.set_quantization(quantization))
+				continue;
+			const bool int8 = quantization == AUIntensityEstimation::QUANTIZATION_INT8;
+			benchmarks.run(int8 ? "au/estimate (int8)" : "au/estimate (int16)", 1, "faces", [&]()
+			{
+				AU_quantized.estimate(face_registered, landmarks49_registered, AU_intensities, AU_workspace);
+			});
+		}
+
+		// 3. Reading face detections: text file of the former stage output and binary result store
+		std::vector<std::vector<dlib::rectangle>> detections;
+		benchmarks.run("io/misc::read_face_detection (text)", num_videos * num_frames, "frames", [&]()
+		{
+			misc::read_face_detection(detections_csv_file, detections);
+		});
+		benchmarks.run("io/read_face_detections (binary)", num_videos * num_frames, "frames", [&]()
+		{
+			read_face_detections(detections_store_file, detections);
+		});
+
+		// 4. BinaryFile arrays (4 MB per operation)
+		std::vector<float> data(1 << 20);
+		cv::RNG rng(5);
+		for (auto & v : data)
+			v = rng.uniform(0.0f, 1.0f);
+		FILE * file = std::tmpfile();
+		CV_Assert(file != NULL);
+		bool okay = true;
+		benchmarks.run("io/BinaryFile::write_n (4 MB)", data.size() * sizeof(float), "bytes", [&]()
+		{
+			std::rewind(file);
+			okay &= BinaryFile::write_n(file, data.data(), data.size());
+			okay &= std::fflush(file) == 0;
+		});
+		benchmarks.run("io/BinaryFile::read_n (4 MB)", data.size() * sizeof(float), "bytes", [&]()
+		{
+			std::rewind(file);
+			okay &= BinaryFile::read_n(file, data.data(), data.size());
+		});
+		std::fclose(file);
+		CV_Assert(okay);
+
+		if (!json_file.empty() && !benchmarks.write_json(json_file))
+		{
+			std::cout << "Error: Cannot write results to " << json_file << std::endl;
+			result = -1;
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::cout << e.what() << std::endl;
+		result = -1;
+	}
+
+	std::error_code ec;
+	fs::remove_all(tmp_dir, ec);
+	return result;
+}
+
+int runEndToEnd(const BenchmarkOptions & options)
+{
+	const SyntheticDatasetParameters & params = options.dataset;
+	const std::string dataset_dir = options.dir + "dataset/";
+	const std::string exdata_dir = options.dir + "exdata/";
+	const std::string train_or_val_or_test = "synthetic";
+
+	struct StageResult
+	{
+		std::string name;
+		double seconds;
+		long frames;
+		long peak_rss_kb;
+	};
+	std::vector<StageResult> stages;
+	bool peak_rss_per_stage = true;
+
+	try
+	{
+		// The dataset is generated again if its parameters changed
+		std::ostringstream dataset_key;
+		dataset_key << params.num_videos << " " << params.num_frames << " " << params.frame_size.width << "x" << params.frame_size.height << " " << params.extension << " " << params.fps;
+		const std::string dataset_key_file = options.dir + "synthetic_dataset.txt";
+		std::string previous_key;
+		std::ifstream key_file(dataset_key_file);
+		std::getline(key_file, previous_key);
+		key_file.close();
+		if (previous_key != dataset_key.str() || options.generate)
+		{
+			std::cout << "Generate synthetic dataset in " << options.dir << " ..." << std::endl;
+			if (fs::exists(dataset_dir))
+				for (auto & f : fs::directory_iterator(dataset_dir))
+					fs::remove(f.path());
+			generateSyntheticDataset(params, dataset_dir, exdata_dir, train_or_val_or_test);
+			std::ofstream(dataset_key_file) << dataset_key.str() << "\n";
+			std::cout << "Done." << std::endl;
+		}
+		if (!options.end_to_end)
+			return 0;
+
+		ExtractionOptions extraction_options;
+		extraction_options.jobs = options.jobs;
+		extraction_options.recompute = true;
+		if (!options.profile_file.empty())
+			profiler::enable();
+
+		// Frames of the dataset processed per second (recognizeFaces() only decodes the first 200 frames of each video)
+		const long num_frames = params.num_videos * params.num_frames;
+		auto run_stage = [&](const std::string & name, long frames, const std::function<void()> & fn)
+		{
+			std::cout << "Benchmark " << name << " ..." << std::endl;
+			peak_rss_per_stage &= reset_peak_rss();
+			profiler::StageScope stage(name);
+			const steady_clock::time_point start = steady_clock::now();
+			fn();
+			StageResult result;
+			result.name = name;
+			result.seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+			result.frames = frames;
+			result.peak_rss_kb = peak_rss_kb();
+			stages.push_back(result);
+		};
+		run_stage("createFileNameList", 0, [&]()
+		{
+			createFileNameList(dataset_dir, exdata_dir, train_or_val_or_test);
+		});
+		// The order of the filename list depends on the file system, the face detections are written in the same order
+		writeSyntheticFaceDetections(params, exdata_dir, train_or_val_or_test);
+		run_stage("detectAUsOld", num_frames, [&]()
+		{
+			detectAUsOld(exdata_dir, train_or_val_or_test, extraction_options);
+		});
+		run_stage("recognizeFaces", params.num_videos * std::min(params.num_frames, 200L), [&]()
+		{
+			recognizeFaces(exdata_dir, train_or_val_or_test, extraction_options);
+		});
+	}
+	catch (std::exception& e)
+	{
+		std::cout << e.what() << std::endl;
+		return -1;
+	}
+
+	std::cout << std::endl << "Synthetic dataset: " << params.num_videos << " videos, " << params.num_frames << " frames each, " << params.frame_size.width << "x" << params.frame_size.height
+	          << " (" << params.extension << "), " << options.jobs << " job(s)" << std::endl;
+	if (!peak_rss_per_stage)
+		std::cout << "The peak memory cannot be reset on this system, it is the peak since the start of the program." << std::endl;
+	for (const auto & stage : stages)
+	{
+		std::cout << std::left << std::setw(24) << stage.name << std::right << std::fixed << std::setw(10) << std::setprecision(2) << stage.seconds << " s"
+		          << std::setw(12) << std::setprecision(1) << (stage.seconds > 0 ? stage.frames / stage.seconds : 0.0) << " frames/s"
+		          << std::setw(10) << std::setprecision(1) << stage.peak_rss_kb / 1024.0 << " MB peak RSS" << std::endl;
+	}
+
+	int result = 0;
+	if (!options.json_file.empty())
+	{
+		std::ofstream file(options.json_file);
+		file << "{\"dataset\": {\"videos\": " << params.num_videos << ", \"frames_per_video\": " << params.num_frames << ", \"width\": " << params.frame_size.width
+		     << ", \"height\": " << params.frame_size.height << ", \"format\": \"" << params.extension.substr(1) << "\"}, \"jobs\": " << options.jobs
+		     << ", \"peak_rss_per_stage\": " << (peak_rss_per_stage ? "true" : "false") << ",\n \"stages\": [";
+		for (size_t i = 0; i < stages.size(); ++i)
+		{
+			const StageResult & stage = stages[i];
+			file << (i ? "," : "") << "\n  {\"name\": \"" << stage.name << "\", \"seconds\": " << stage.seconds << ", \"frames\": " << stage.frames
+			     << ", \"frames_per_second\": " << (stage.seconds > 0 ? stage.frames / stage.seconds : 0.0) << ", \"peak_rss_kb\": " << stage.peak_rss_kb << "}";
+		}
+		file << "\n]}\n";
+		file.close();
+		if (file.fail())
+		{
+			std::cout << "Error: Cannot write results to " << options.json_file << std::endl;
+			result = -1;
+		}
+	}
+	if (!options.profile_file.empty() && !profiler::write_summary(options.profile_file))
+	{
+		std::cout << "Error: Cannot write profile to " << options.profile_file << std::endl;
+		result = -1;
+	}
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	BenchmarkOptions options;
+	if (!parseOptions(argc, argv, options))
+		return help();
+
+	if (options.check)
+		return runChecks();
+	if (options.end_to_end || options.generate)
+		return runEndToEnd(options);
+	return runMicroBenchmarks(options);
+}
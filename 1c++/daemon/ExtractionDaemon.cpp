@@ -0,0 +1,536 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "ExtractionDaemon.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <experimental/filesystem>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <dlib/serialize.h>
+
+#include "misc.hpp"
+#include "ResultStore.hpp"
+#include "LandmarkCache.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	// Maximum length of a request line
+	const size_t max_request_size = 64 * 1024;
+
+	// A client must send its request within this time after connecting
+	const std::chrono::milliseconds request_timeout(2000);
+
+	// Sending a response fails if the client does not read anything within this time (e.g. it stopped without closing
+	// the connection), so a worker is not blocked forever
+	const timeval send_timeout = { 30, 0 };
+
+	// Connection whose request line is not complete yet
+	struct PendingRequest
+	{
+		int fd;
+		std::string request;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	bool send_all(int fd, const std::string & data)
+	{
+		size_t sent = 0;
+		while (sent < data.size())
+		{
+			// MSG_NOSIGNAL: a client that closed the connection must not terminate the daemon with SIGPIPE
+			const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			sent += n;
+		}
+		return true;
+	}
+
+	/* Append the data that is available on fd to request without blocking. Returns 1 if the request line is complete
+	 * (request is cut at the newline), 0 if more data is expected, and -1 on error, end of stream, or if the line is too long.
+	 */
+	int read_request(int fd, std::string & request)
+	{
+		char buffer[4096];
+		const ssize_t n = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -1;
+		request.append(buffer, n);
+		const size_t newline = request.find('\n');
+		if (newline != std::string::npos)
+		{
+			request.resize(newline);
+			return 1;
+		}
+		return request.size() < max_request_size ? 0 : -1;
+	}
+
+	bool make_address(const std::string & socket_path, sockaddr_un & addr)
+	{
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (socket_path.empty() || socket_path.size() >= sizeof(addr.sun_path))
+			return false;
+		std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+		return true;
+	}
+
+	// Connected socket or -1
+	int connect_to(const std::string & socket_path)
+	{
+		sockaddr_un addr;
+		if (!make_address(socket_path, addr))
+			return -1;
+		const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0)
+		{
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	std::string single_line(const std::string & message)
+	{
+		std::string line = message;
+		std::replace(line.begin(), line.end(), '\n', ' ');
+		return line;
+	}
+
+	// Results as text: a header line per output followed by one line per frame (resp. face descriptor)
+	void write_activity(std::ostream & os, const FacialActivity & activity, int outputs)
+	{
+		os << "OK " << activity.num_frames << " frames\n";
+		if (outputs & FacialActivityExtractor::OUTPUT_FACES)
+		{
+			// Face box (x, y, width, height) as in xxx_facedet.txt
+			os << "faces " << activity.faces.size() << "\n";
+			for (const dlib::rectangle & det : activity.faces)
+				os << det.left() << " " << det.top() << " " << det.width() << " " << det.height() << "\n";
+		}
+		if (outputs & FacialActivityExtractor::OUTPUT_LANDMARKS)
+		{
+			const long num_points = activity.landmarks.empty() ? 0 : activity.landmarks[0].num_parts();
+			os << "landmarks " << activity.landmarks.size() << " " << num_points << "\n";
+			for (const dlib::full_object_detection & shape : activity.landmarks)
+			{
+				for (unsigned long part_no = 0; part_no < shape.num_parts(); ++part_no)
+					os << (part_no ? " " : "") << shape.part(part_no).x() << " " << shape.part(part_no).y();
+				os << "\n";
+			}
+		}
+		if (outputs & FacialActivityExtractor::OUTPUT_AUS)
+		{
+			// Header with the AU ids of the columns
+			os << "aus " << activity.AU_intensities.rows << " " << activity.AU_ids.total();
+			for (size_t i = 0; i < activity.AU_ids.total(); ++i)
+				os << " " << activity.AU_ids.at<int>(i);
+			os << "\n";
+			for (int row = 0; row < activity.AU_intensities.rows; ++row)
+			{
+				const float * values = activity.AU_intensities.ptr<float>(row);
+				for (int col = 0; col < activity.AU_intensities.cols; ++col)
+					os << (col ? " " : "") << values[col];
+				os << "\n";
+			}
+		}
+		if (outputs & FacialActivityExtractor::OUTPUT_IDENTITY)
+		{
+			const long dims = activity.face_descriptors.empty() ? 0 : activity.face_descriptors[0].size();
+			os << "identity " << activity.face_descriptors.size() << " " << dims << "\n";
+			for (const FacialActivity::descriptor_type & descriptor : activity.face_descriptors)
+			{
+				for (long i = 0; i < descriptor.size(); ++i)
+					os << (i ? " " : "") << descriptor(i);
+				os << "\n";
+			}
+		}
+	}
+
+	/* Results as files in the formats of the extraction stages (with a single video), the response lists the files.
+	 * The filenames include the job id, so jobs of videos with the same name (or the same video) do not overwrite each other.
+	 */
+	void write_activity_files(std::ostream & os, const FacialActivity & activity, int outputs, const std::string & result_dir, const std::string & video, long job_id)
+	{
+		const std::string prefix = (fs::path(result_dir) / fs::path(video).stem()).string() + "_job" + std::to_string(job_id);
+		os << "OK " << activity.num_frames << " frames\n";
+		if (outputs & FacialActivityExtractor::OUTPUT_FACES)
+		{
+			const std::string filename = prefix + "_facedet.bin";
+			ResultVideo det_video(face_detection_columns());
+			for (const dlib::rectangle & det : activity.faces)
+			{
+				const int32_t box[4] = { int32_t(det.left()), int32_t(det.top()), int32_t(det.width()), int32_t(det.height()) };
+				det_video.append(0, box);
+			}
+			ResultStoreWriter writer(filename, 1, face_detection_columns());
+			DLIB_CASSERT(writer.is_open(), "Could not open filename: " << filename << " for writing.");
+			writer.write(0, std::move(det_video));
+			DLIB_CASSERT(writer.close(), "Error writing face detections to " << filename);
+			os << "faces " << filename << "\n";
+		}
+		if (outputs & FacialActivityExtractor::OUTPUT_LANDMARKS)
+		{
+			const std::string filename = prefix + "_landmarks.bin";
+			const long num_points = activity.landmarks.empty() ? 68 : activity.landmarks[0].num_parts();
+			std::vector<int16_t> video_landmarks;
+			for (const dlib::full_object_detection & shape : activity.landmarks)
+				LandmarkCacheWriter::append(shape, video_landmarks);
+			LandmarkCacheWriter writer(filename, 1, num_points);
+			DLIB_CASSERT(writer.is_open(), "Could not open filename: " << filename << " for writing.");
+			writer.write(0, std::move(video_landmarks));
+			DLIB_CASSERT(writer.close(), "Error writing landmarks to " << filename);
+			os << "landmarks " << filename << "\n";
+		}
+		if (outputs & FacialActivityExtractor::OUTPUT_AUS)
+		{
+			const std::string filename = prefix + "_AUOld.bin";
+			const std::vector<ResultColumn> AU_columns = au_columns(activity.AU_intensities.cols);
+			ResultVideo AU_video(AU_columns);
+			for (int row = 0; row < activity.AU_intensities.rows; ++row)
+				AU_video.append(0, activity.AU_intensities.ptr<float>(row));
+			ResultStoreWriter writer(filename, 1, AU_columns);
+			DLIB_CASSERT(writer.is_open(), "Could not open filename: " << filename << " for writing.");
+			writer.write(0, std::move(AU_video));
+			DLIB_CASSERT(writer.close(), "Error writing AUs to " << filename);
+			os << "aus " << filename << "\n";
+		}
+		if (outputs & FacialActivityExtractor::OUTPUT_IDENTITY)
+		{
+			// Same format as xxx_face_descriptors.dat of recognizeFaces() (with a single video)
+			const std::string filename = prefix + "_face_descriptors.dat";
+			dlib::serialize(filename) << std::vector<std::vector<FacialActivity::descriptor_type>>(1, activity.face_descriptors)
+			                          << std::vector<dlib::matrix<dlib::rgb_pixel>>(1, activity.first_face);
+			os << "identity " << filename << "\n";
+		}
+	}
+}
+
+ExtractionDaemon::ExtractionDaemon(const std::string& exdata_dir, const ExtractionOptions& options, long max_queued)
+	: m_options(options),
+	  m_max_queued(std::max(max_queued, 1L)),
+	  m_closed(false),
+	  m_num_jobs(0),
+	  m_num_running(0),
+	  m_num_done(0),
+	  m_num_failed(0),
+	  m_stop(false)
+{
+	// One copy of the models per worker
+	const long num_jobs = std::max(options.jobs, 1L);
+	m_extractors.reserve(num_jobs);
+	m_extractors.emplace_back(exdata_dir, options);
+	for (long job_id = 1; job_id < num_jobs; ++job_id)
+		m_extractors.push_back(m_extractors[0]);
+}
+
+ExtractionDaemon::~ExtractionDaemon()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+	}
+	m_job_available.notify_all();
+	for (std::thread & worker : m_workers)
+		worker.join();
+}
+
+int ExtractionDaemon::parse_outputs(const std::string& outputs)
+{
+	int flags = 0;
+	std::istringstream ss(outputs);
+	std::string output;
+	while (std::getline(ss, output, ','))
+	{
+		if (output == "faces")
+			flags |= FacialActivityExtractor::OUTPUT_FACES;
+		else if (output == "landmarks")
+			flags |= FacialActivityExtractor::OUTPUT_LANDMARKS;
+		else if (output == "aus")
+			flags |= FacialActivityExtractor::OUTPUT_AUS;
+		else if (output == "identity")
+			flags |= FacialActivityExtractor::OUTPUT_IDENTITY;
+		else if (output == "all")
+			flags |= FacialActivityExtractor::OUTPUT_ALL;
+		else
+			return 0;
+	}
+	return flags;
+}
+
+bool ExtractionDaemon::run(const std::string& socket_path)
+{
+	sockaddr_un addr;
+	if (!make_address(socket_path, addr))
+	{
+		std::cout << "Error: Invalid socket path " << socket_path << std::endl;
+		return false;
+	}
+
+	// A socket file without daemon is left over from a previous run that was killed
+	const int other = connect_to(socket_path);
+	if (other >= 0)
+	{
+		::close(other);
+		std::cout << "Error: Another daemon is running on " << socket_path << std::endl;
+		return false;
+	}
+	::unlink(socket_path.c_str());
+
+	const int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0 || ::bind(server, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(server, 64) != 0)
+	{
+		std::cout << "Error: Cannot listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+		if (server >= 0)
+			::close(server);
+		return false;
+	}
+
+	for (long worker_id = 0; worker_id < static_cast<long>(m_extractors.size()); ++worker_id)
+		m_workers.push_back(std::thread(&ExtractionDaemon::work, this, worker_id));
+	{
+		std::lock_guard<std::mutex> lock(misc::output_mutex());
+		std::cout << "Listening on " << socket_path << " with " << m_workers.size() << " workers (at most " << m_max_queued << " queued jobs)." << std::endl;
+	}
+
+	/* The requests are read without blocking in the same poll loop as the new connections, so clients that connect but
+	 * send nothing (or slowly) do not delay the others. Polling with a timeout notices stop() without relying on
+	 * poll() being interrupted by signals.
+	 */
+	std::vector<PendingRequest> pending;
+	std::vector<pollfd> pfds;
+	while (!m_stop)
+	{
+		pfds.assign(1, pollfd{ server, POLLIN, 0 });
+		for (const PendingRequest & p : pending)
+			pfds.push_back(pollfd{ p.fd, POLLIN, 0 });
+		const int ready = ::poll(pfds.data(), pfds.size(), 200);
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		// Backwards, so the remaining requests keep their index in pfds
+		for (size_t i = pending.size(); i-- > 0;)
+		{
+			PendingRequest & p = pending[i];
+			int state = 0;
+			if (ready > 0 && (pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+				state = read_request(p.fd, p.request);
+			if (state == 0 && now < p.deadline)
+				continue;
+			if (state == 1)
+				handle_request(p.fd, p.request);
+			else
+			{
+				send_all(p.fd, "ERROR Incomplete request\n");
+				::close(p.fd);
+			}
+			pending.erase(pending.begin() + i);
+		}
+
+		if (ready > 0 && (pfds[0].revents & POLLIN))
+		{
+			const int fd = ::accept(server, NULL, NULL);
+			if (fd >= 0)
+			{
+				::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+				pending.push_back(PendingRequest{ fd, std::string(), now + request_timeout });
+			}
+		}
+	}
+	for (const PendingRequest & p : pending)
+		::close(p.fd);
+	::close(server);
+	::unlink(socket_path.c_str());
+
+	// Finish the queued jobs
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+	}
+	m_job_available.notify_all();
+	for (std::thread & worker : m_workers)
+		worker.join();
+	m_workers.clear();
+
+	std::lock_guard<std::mutex> lock(misc::output_mutex());
+	std::cout << "Stopped after " << m_num_done << " jobs (" << m_num_failed << " failed)." << std::endl;
+	return true;
+}
+
+void ExtractionDaemon::handle_request(int fd, std::string request)
+{
+	if (!request.empty() && request.back() == '\r')
+		request.pop_back();
+
+	std::istringstream ss(request);
+	std::string command;
+	ss >> command;
+	if (command == "STATUS")
+	{
+		std::ostringstream response;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			response << "OK queued " << m_queue.size() << " running " << m_num_running << " done " << m_num_done << " failed " << m_num_failed
+			         << " workers " << m_extractors.size() << " max_queued " << m_max_queued << "\n";
+		}
+		send_all(fd, response.str());
+	}
+	else if (command == "SHUTDOWN")
+	{
+		m_stop = true;
+		send_all(fd, "OK shutting down\n");
+	}
+	else if (command == "EXTRACT")
+	{
+		// EXTRACT <outputs> <video_path>[\t<result_dir>] (the paths may contain spaces)
+		Job job;
+		job.fd = fd;
+		std::string outputs, path;
+		ss >> outputs;
+		std::getline(ss >> std::ws, path);
+		const size_t tab = path.find('\t');
+		job.video = path.substr(0, tab);
+		job.result_dir = tab == std::string::npos ? std::string() : path.substr(tab + 1);
+		job.outputs = parse_outputs(outputs);
+
+		std::string error;
+		std::error_code ec;
+		if (job.outputs == 0)
+			error = "Unknown outputs " + outputs + " (use a comma separated list of faces, landmarks, aus, identity, or all)";
+		else if (!fs::is_regular_file(job.video, ec))
+			error = "Video not found: " + job.video;
+		else if (!job.result_dir.empty() && !fs::is_directory(job.result_dir, ec))
+			error = "Result directory not found: " + job.result_dir;
+		if (!error.empty())
+		{
+			send_all(fd, "ERROR " + error + "\n");
+			::close(fd);
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (static_cast<long>(m_queue.size()) >= m_max_queued)
+		{
+			const size_t num_queued = m_queue.size();
+			lock.unlock();
+			send_all(fd, "BUSY queued " + std::to_string(num_queued) + "\n");
+			::close(fd);
+			return;
+		}
+		// The worker answers and closes the connection
+		job.id = ++m_num_jobs;
+		m_queue.push_back(std::move(job));
+		lock.unlock();
+		m_job_available.notify_one();
+		return;
+	}
+	else
+		send_all(fd, "ERROR Unknown command " + single_line(command) + "\n");
+	::close(fd);
+}
+
+void ExtractionDaemon::work(long worker_id)
+{
+	FacialActivityExtractor & extractor = m_extractors.at(worker_id);
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_job_available.wait(lock, [this]() { return !m_queue.empty() || m_closed; });
+			if (m_queue.empty())
+				return;
+			job = std::move(m_queue.front());
+			m_queue.pop_front();
+			++m_num_running;
+		}
+
+		bool okay = true;
+		std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
+		try
+		{
+			process(extractor, job);
+		}
+		catch (std::exception & e)
+		{
+			okay = false;
+			send_all(job.fd, "ERROR " + single_line(e.what()) + "\n");
+		}
+		::close(job.fd);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_num_running;
+			++(okay ? m_num_done : m_num_failed);
+		}
+		std::lock_guard<std::mutex> lock(misc::output_mutex());
+		std::cout << (okay ? "Finished " : "Failed ") << job.video << " in " << seconds << " s (job " << job.id << ", worker " << worker_id << ")" << std::endl;
+	}
+}
+
+void ExtractionDaemon::process(FacialActivityExtractor& extractor, const Job& job)
+{
+	const FacialActivity activity = extractor.process_video(job.video, job.outputs);
+	std::ostringstream response;
+	if (job.result_dir.empty())
+		write_activity(response, activity, job.outputs);
+	else
+		write_activity_files(response, activity, job.outputs, job.result_dir, job.video, job.id);
+	// The client may have given up waiting, then the results are dropped
+	send_all(job.fd, response.str());
+}
+
+std::string daemon_request(const std::string& socket_path, const std::string& request, std::ostream& os)
+{
+	const int fd = connect_to(socket_path);
+	if (fd < 0)
+		return std::string();
+	if (!send_all(fd, request + "\n"))
+	{
+		::close(fd);
+		return std::string();
+	}
+	::shutdown(fd, SHUT_WR);
+
+	// The first line is returned, the whole response is written to os
+	std::string first_line;
+	bool first_line_complete = false;
+	char buffer[64 * 1024];
+	while (true)
+	{
+		const ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		os.write(buffer, n);
+		for (ssize_t i = 0; i < n && !first_line_complete; ++i)
+		{
+			if (buffer[i] == '\n')
+				first_line_complete = true;
+			else
+				first_line.push_back(buffer[i]);
+		}
+	}
+	::close(fd);
+	return first_line;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "ExtractionOptions.hpp"
+#include "FacialActivityExtractor.hpp"
+
+/* Long-running extraction service that keeps the models loaded (see FacialActivityExtractor).
+ * Clients connect to a Unix domain socket and send a single request line, the daemon answers and closes the connection.
+ *   EXTRACT <outputs> <video_path>                 Results in the response (text, see write_activity() in ExtractionDaemon.cpp)
+ *   EXTRACT <outputs> <video_path>\t<result_dir>   Results written to result_dir/<video>_job<id>_..., the response lists the files
+ *   STATUS                                         Number of queued, running, finished, and failed jobs
+ *   SHUTDOWN                                       Finish the queued jobs and exit
+ * outputs is a comma separated list of faces, landmarks, aus, identity (or all).
+ * The jobs are processed by a pool of worker threads (each with its own copy of the models). At most max_queued jobs wait
+ * for a worker; further EXTRACT requests are answered with "BUSY" so the client can retry later (backpressure).
+ * The first line of each response is "OK ...", "BUSY", or "ERROR <message>".
+ * The request line must be sent within 2 s after connecting. A client that stops reading the response for 30 s is
+ * disconnected, so neither blocks the daemon.
+ */
+class ExtractionDaemon
+{
+public:
+	/// Load the models from exdata_dir, options.jobs is the number of worker threads
+	ExtractionDaemon(const std::string & exdata_dir, const ExtractionOptions & options, long max_queued);
+	~ExtractionDaemon();
+
+	/// Accept requests on socket_path until SHUTDOWN is received or stop() is called, returns false if the socket cannot be opened
+	bool run(const std::string & socket_path);
+
+	/// Stop accepting requests (e.g. from a signal handler); the queued jobs are finished before run() returns
+	void stop() { m_stop = true; }
+
+	/// Parse an outputs list like "aus,identity" into FacialActivityExtractor::Output flags, returns 0 if invalid
+	static int parse_outputs(const std::string & outputs);
+
+private:
+	struct Job
+	{
+		long id;	// Consecutive number of the accepted jobs, starting at 1
+		int fd;
+		int outputs;
+		std::string video;
+		std::string result_dir;
+	};
+
+	/// Answer a request line, EXTRACT requests are queued (the worker answers and closes fd)
+	void handle_request(int fd, std::string request);
+	void work(long worker_id);
+	void process(FacialActivityExtractor & extractor, const Job & job);
+
+	ExtractionOptions m_options;
+	long m_max_queued;
+	std::vector<FacialActivityExtractor> m_extractors;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_job_available;
+	std::deque<Job> m_queue;
+	bool m_closed;
+	long m_num_jobs, m_num_running, m_num_done, m_num_failed;
+	std::atomic<bool> m_stop;
+};
+
+/* Send a request line to the daemon at socket_path and write the response to os.
+ * Returns the first line of the response (empty if the daemon is not reachable).
+ */
+std::string daemon_request(const std::string & socket_path, const std::string & request, std::ostream & os);
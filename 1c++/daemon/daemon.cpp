@@ -0,0 +1,190 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+/* Extraction daemon and its local client (see ExtractionDaemon.hpp).
+ * "serve" loads the models once and processes the videos sent by the clients until it is stopped, which avoids loading
+ * the face detector, shape predictor, face recognition network, and AU model for every run.
+ * "extract", "status", and "shutdown" send a request to a running daemon and print the response.
+ * See help() for the arguments.
+ */
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <experimental/filesystem>
+#include "ExtractionOptions.hpp"
+#include "ExtractionDaemon.hpp"
+bool parseOptions(int argc, char **argv, int first_arg, ExtractionOptions& options);
+int help();
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	ExtractionDaemon * running_daemon = NULL;
+
+	void stop_daemon(int)
+	{
+		if (running_daemon)
+			running_daemon->stop();
+	}
+
+	int serve(int argc, char **argv)
+	{
+		// serve <exdata_dir> <socket> [--queue N] [extraction options]
+		std::string exdata_dir = std::string(argv[2]);
+		const std::string socket_path = std::string(argv[3]);
+		if(!fs::is_directory(exdata_dir))
+		{
+			std::cout << "Error: " << exdata_dir << " is not a valid directory." << std::endl;
+			return -1;
+		}
+		if(exdata_dir.back() != '/')
+			exdata_dir.push_back('/');
+
+		// --queue is handled here, the other options are those of the extraction (see main.cpp)
+		long max_queued = 0;
+		std::vector<char *> extraction_args(argv, argv + 4);
+		for(int i = 4; i < argc; ++i)
+		{
+			if(std::string(argv[i]) == "--queue" && i + 1 < argc)
+			{
+				max_queued = std::atol(argv[++i]);
+				if(max_queued < 1)
+				{
+					std::cout << "Error: --queue requires a positive number" << std::endl;
+					return help();
+				}
+			}
+			else
+				extraction_args.push_back(argv[i]);
+		}
+		ExtractionOptions options;
+		if(!parseOptions(static_cast<int>(extraction_args.size()), extraction_args.data(), 4, options))
+			return help();
+		if(max_queued == 0)
+			max_queued = 2 * options.jobs;
+
+		try
+		{
+			std::cout << "Loading models from " << exdata_dir << " ..." << std::endl;
+			ExtractionDaemon daemon(exdata_dir, options, max_queued);
+			running_daemon = &daemon;
+			std::signal(SIGINT, stop_daemon);
+			std::signal(SIGTERM, stop_daemon);
+			const bool okay = daemon.run(socket_path);
+			running_daemon = NULL;
+			return okay ? 0 : -1;
+		}
+		catch (std::exception& e)
+		{
+			std::cout << e.what() << std::endl;
+			return -1;
+		}
+	}
+
+	int extract(int argc, char **argv)
+	{
+		// extract <socket> <video> [--outputs LIST] [--result-dir DIR] [--no-wait]
+		const std::string socket_path = std::string(argv[2]);
+		std::string outputs = "all";
+		std::string result_dir;
+		bool wait = true;
+		for(int i = 4; i < argc; ++i)
+		{
+			std::string arg = std::string(argv[i]);
+			if(arg == "--outputs" && i + 1 < argc)
+			{
+				outputs = std::string(argv[++i]);
+				if(ExtractionDaemon::parse_outputs(outputs) == 0)
+				{
+					std::cout << "Error: --outputs must be a comma separated list of faces, landmarks, aus, identity, or all" << std::endl;
+					return help();
+				}
+			}
+			else if(arg == "--result-dir" && i + 1 < argc)
+				result_dir = std::string(argv[++i]);
+			else if(arg == "--no-wait")
+				wait = false;
+			else
+			{
+				std::cout << "Error: Unknown option " << arg << std::endl;
+				return help();
+			}
+		}
+
+		// The daemon may run in another working directory
+		std::string request = "EXTRACT " + outputs + " " + fs::absolute(argv[3]).string();
+		if(!result_dir.empty())
+			request += "\t" + fs::absolute(result_dir).string();
+
+		while(true)
+		{
+			std::ostringstream response;
+			const std::string status = daemon_request(socket_path, request, response);
+			if(status.empty())
+			{
+				std::cout << "Error: No daemon is running on " << socket_path << std::endl;
+				return -1;
+			}
+			// The daemon has no free slot in its queue, try again later
+			if(status.compare(0, 4, "BUSY") == 0 && wait)
+			{
+				std::this_thread::sleep_for(std::chrono::seconds(1));
+				continue;
+			}
+			std::cout << response.str() << std::flush;
+			return status.compare(0, 2, "OK") == 0 ? 0 : -1;
+		}
+	}
+
+	int command(const std::string & socket_path, const std::string & request)
+	{
+		const std::string status = daemon_request(socket_path, request, std::cout);
+		if(status.empty())
+		{
+			std::cout << "Error: No daemon is running on " << socket_path << std::endl;
+			return -1;
+		}
+		return status.compare(0, 2, "OK") == 0 ? 0 : -1;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const std::string mode = argc > 1 ? std::string(argv[1]) : std::string();
+	if(mode == "serve" && argc >= 4)
+		return serve(argc, argv);
+	if(mode == "extract" && argc >= 4)
+		return extract(argc, argv);
+	if(mode == "status" && argc == 3)
+		return command(argv[2], "STATUS");
+	if(mode == "shutdown" && argc == 3)
+		return command(argv[2], "SHUTDOWN");
+	return help();
+}
+
+int help()
+{
+	std::cout << std::endl;
+	std::cout << "usage: ICCV17Daemon serve <exdata_dir> <socket> [--queue N] [options]" << std::endl;
+	std::cout << "       ICCV17Daemon extract <socket> <video> [--outputs LIST] [--result-dir DIR] [--no-wait]" << std::endl;
+	std::cout << "       ICCV17Daemon status <socket>" << std::endl;
+	std::cout << "       ICCV17Daemon shutdown <socket>" << std::endl;
+	std::cout << "serve: Load the models from exdata_dir once and process the videos sent to the Unix domain socket (a file path, e.g. /tmp/iccv17.sock) until shutdown, SIGINT, or SIGTERM." << std::endl;
+	std::cout << "  --jobs N: Number of worker threads, each with its own copy of the models (default: 1)." << std::endl;
+	std::cout << "  --queue N: Number of videos that may wait for a worker (default: 2 * jobs). Further requests are answered with BUSY." << std::endl;
+	std::cout << "  The other options of the extraction (e.g. --detector, --track, --au-quantized) are those of ICCV17Challenge." << std::endl;
+	std::cout << "extract: Process a video with the daemon and print the results (one line per frame) or, with --result-dir, write them to DIR and print the filenames." << std::endl;
+	std::cout << "  --outputs LIST: Comma separated list of faces, landmarks, aus, identity, or all (default: all)." << std::endl;
+	std::cout << "  --result-dir DIR: Write the results to DIR/<video>_job<id>_facedet.bin, _landmarks.bin, _AUOld.bin, and _face_descriptors.dat (same formats as ICCV17Challenge). The job id is numbered by the daemon, so the results of videos with the same name do not overwrite each other." << std::endl;
+	std::cout << "  --no-wait: Fail if the queue of the daemon is full instead of retrying every second." << std::endl;
+	std::cout << "status: Print the number of queued, running, finished, and failed videos." << std::endl;
+	std::cout << "shutdown: Stop the daemon after the queued videos are finished." << std::endl;
+	std::cout << std::endl;
+	return -1;
+}
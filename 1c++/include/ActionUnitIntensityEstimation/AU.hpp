@@ -1,6 +1,10 @@
 #pragma once
 
 #include <opencv2/core/core.hpp>
+#include <ActionUnitIntensityEstimation/LbpSimd.hpp>
+#include <ActionUnitIntensityEstimation/QuantizedDot.hpp>
+#include <MemoryMappedFile.hpp>
+#include <memory>
 
 class AUIntensityEstimation
 {
@@ -10,6 +14,13 @@ public:
 		m_init_feat = false;
 		m_init_mean_std = false;
 		m_init_regressor = false;
+		m_lbp_kernel = LBP_KERNEL_GENERIC;
+		m_lbp_row_kernel = 0;
+		m_lbp_per_block_border = true;
+		m_fold_normalization = true;
+		m_quantization = QUANTIZATION_NONE;
+		m_quantized_dot16 = 0;
+		m_quantized_dot8 = 0;
 	}
 
 	inline AUIntensityEstimation(const std::string & feature_model_filename, const std::string & mean_std_filename, const std::string & regressor_filename)
@@ -17,17 +28,79 @@ public:
 		m_init_feat = false;
 		m_init_mean_std = false;
 		m_init_regressor = false;
+		m_lbp_kernel = LBP_KERNEL_GENERIC;
+		m_lbp_row_kernel = 0;
+		m_lbp_per_block_border = true;
+		m_fold_normalization = true;
+		m_quantization = QUANTIZATION_NONE;
+		m_quantized_dot16 = 0;
+		m_quantized_dot8 = 0;
 		init(feature_model_filename, mean_std_filename, regressor_filename);
 	};
 
 	bool init(const std::string & feature_model_filename, const std::string & mean_std_filename, const std::string & regressor_filename);
 
+	// Load the model from a binary file written by save(). The file is memory mapped and the model matrices point to the
+	// mapped data. Returns false if the file does not exist or is invalid (e.g. checksum mismatch).
+	bool init(const std::string & binary_model_filename);
+
+	// Save the model (e.g. loaded from the text files) to a single binary file
+	bool save(const std::string & binary_model_filename) const;
+
+
+	// Buffers of estimate() and estimate_batch(), which are reused for every frame. With the 8 neighbors / radius 1 LBP features
+	// no memory is allocated per frame once the buffers have their final size (see init_workspace()), given that
+	// AUintensities keeps its size, too. A workspace must not be used by several threads at the same time.
+	struct Workspace
+	{
+		cv::Mat gray;		// 8 bit grayscale face
+		cv::Mat codes;		// Mapped LBP codes of the face
+		cv::Mat features;	// Combined features, one row per frame
+		cv::Mat rho;		// Regression offset, one row per frame (estimate_batch() only)
+		cv::Mat hist;		// 16 bit LBP histograms (quantized model only)
+	};
+
+	// Allocate the buffers of the workspace for registered faces of the given size and batches of up to max_frames frames
+	bool init_workspace(Workspace & workspace, const cv::Size & face_size, int max_frames = 1) const;
+
 
 	bool estimate(const cv::Mat & image_registered, const std::vector<cv::Point2f> landmarks_registred, cv::Mat & AUintensities) const;
+	bool estimate(const cv::Mat & image_registered, const std::vector<cv::Point2f> & landmarks_registred, cv::Mat & AUintensities, Workspace & workspace) const;
+
+	// Same as estimate() for several frames (one row of AUintensities per frame). The features of all frames are normalized
+	// and multiplied with the regression weights at once, which is faster than calling estimate() for every frame.
+	bool estimate_batch(const std::vector<cv::Mat> & images_registered, const std::vector<std::vector<cv::Point2f>> & landmarks_registered, cv::Mat & AUintensities) const;
+	bool estimate_batch(const std::vector<cv::Mat> & images_registered, const std::vector<std::vector<cv::Point2f>> & landmarks_registered, cv::Mat & AUintensities, Workspace & workspace) const;
 	
 
 	void visualize(cv::Mat & image, const std::vector<cv::Point2f> & landmarks, const cv::Mat & AUintensities, const std::vector<int> & AUIds = std::vector<int>(), const cv::Rect & bbox = cv::Rect(0,0,0,0)) const;
 
+	// LBP features with 8 neighbors and radius 1 are computed on the code image of the whole face. If enabled (default), the
+	// pixels on the border of each block are not counted, exactly as in the per block computation the shipped models are
+	// trained with. If disabled, all pixels of the blocks are counted (needs a regression model trained on these features).
+	// Other LBP models are always computed per block.
+	inline void set_lbp_per_block_border(bool enable) {
+		m_lbp_per_block_border = enable;
+	}
+
+	// If enabled (default), the feature normalization is folded into the regression weights at load time, which saves two
+	// passes over the features per frame. The results differ from the separate normalization only by float rounding
+	// (see "ICCV17Benchmark --check"). The unfolded model is used if the folded weights are not finite.
+	inline void set_fold_normalization(bool enable) {
+		m_fold_normalization = enable;
+	}
+
+	// Optional quantized regression: the LBP histograms are counted in 16 bit integers and multiplied with 16 or 8 bit
+	// weights (one scale per AU) in 32 bit integer arithmetic, the landmark features stay in float. It is based on the
+	// model with folded normalization and is used for 8 neighbors / radius 1 LBP features only. Returns false if the model
+	// cannot be quantized (the float model is used then). Keeps the setting when a new model is loaded.
+	enum Quantization { QUANTIZATION_NONE, QUANTIZATION_INT16, QUANTIZATION_INT8 };
+	bool set_quantization(Quantization quantization);
+
+	inline Quantization get_quantization() const {
+		return m_quantization;
+	}
+
 	inline bool is_initialized() const {
 		return m_init_feat && m_init_mean_std && m_init_regressor;
 	}
@@ -42,17 +115,35 @@ public:
 
 private:
 
+	// The micro benchmarks (benchmark/benchmark.cpp) measure the feature extraction steps separately
+	friend class AUIntensityEstimationBenchmark;
+
 	bool load_feature_model(const std::string & filename);
 	bool load_mean_std(const std::string & filename);
 	bool load_regression_model(const std::string & filename);
 
 
 	bool extract_features(const cv::Mat & image_registered, cv::Mat & features) const;
-	bool combine_and_normalize(const std::vector<cv::Point2f> & landmarks, const cv::Mat & lbp_features, cv::Mat & features_combined) const;
-	bool regression(const cv::Mat & feature, cv::Mat & prob) const;
+	bool extract_combined_features(const cv::Mat & image_registered, const std::vector<cv::Point2f> & landmarks, Workspace & workspace, float* features) const;
+	void normalize(float* features) const;
+	bool fold_normalization();
+	inline bool use_folded_model() const {
+		return m_fold_normalization && !m_wt_folded.empty();
+	}
+	void regression(const float* features, float* prob) const;
+	bool use_quantized_model(const cv::Mat & image_registered) const;
+	bool estimate_quantized(const cv::Mat & image_registered, const std::vector<cv::Point2f> & landmarks, Workspace & workspace, float* prob) const;
 
 
 	bool lbp(const cv::Mat& image, cv::Mat& feature) const;
+	void init_lbp_8_1();
+	bool use_lbp_8_1(const cv::Mat& image) const;
+	bool lbp_features_8_1(const cv::Mat& image, Workspace& workspace, float* features) const;
+	bool lbp_codes_8_1(const cv::Mat& image, Workspace& workspace) const;
+	template<typename T>
+	void lbp_histograms_8_1(const cv::Mat& codes, T* hist) const;
+	template<bool interpolate_diagonals>
+	void lbp_code_image_8_1(const cv::Mat& image, cv::Mat& codes) const;
 	cv::Mat roundn(const cv::Mat& x, const int n) const;
 	double roundn(const double x, const int n) const;
 
@@ -74,6 +165,15 @@ private:
 	cv::Mat m_lbp_table;
 	cv::Mat m_lbp_num_mapping;
 
+	// Specialized lbp kernel for 8 neighbors and radius 1 on 8 bit images (see init_lbp_8_1())
+	enum LbpKernel { LBP_KERNEL_GENERIC, LBP_KERNEL_8_1, LBP_KERNEL_8_1_NEAREST };
+	LbpKernel m_lbp_kernel;
+	int m_lbp_offset_x[8][4];	// Sample positions relative to the center pixel
+	int m_lbp_offset_y[8][4];	// (4 samples for interpolated neighbors, only the first one otherwise)
+	double m_lbp_weights[8][4];	// Interpolation weights
+	LbpRowKernel8 m_lbp_row_kernel;	// SIMD implementation for this CPU (0 if not available)
+	bool m_lbp_per_block_border;
+
 	cv::Mat m_mean;
 	cv::Mat m_std_inv;
 
@@ -81,4 +181,19 @@ private:
 	cv::Mat m_AUIds;
 	cv::Mat m_rho;
 	cv::Mat m_wt;
+
+	// Regression model with folded normalization
+	bool m_fold_normalization;
+	cv::Mat m_wt_folded;
+	cv::Mat m_rho_folded;
+
+	// Quantized regression model (see set_quantization())
+	Quantization m_quantization;
+	cv::Mat m_wt_quantized;		// Weights of the LBP features, one row per AU (CV_16SC1 or CV_8SC1)
+	cv::Mat m_wt_scale;		// Scale of the quantized weights of each AU (CV_64FC1)
+	QuantizedDot16 m_quantized_dot16;	// SIMD implementations for this CPU (0 if not available)
+	QuantizedDot8 m_quantized_dot8;
+
+	// Mapped binary model file (if loaded from it)
+	std::shared_ptr<MemoryMappedFile> m_model_file;
 };
\ No newline at end of file
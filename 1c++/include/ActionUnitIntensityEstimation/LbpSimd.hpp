@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+/* Vectorized row kernels of the LBP operator with 8 neighbors and radius 1 (see AUIntensityEstimation::lbp_8_1()).
+ * Each kernel is compiled for its instruction set in its own translation unit and selected at runtime, so this header must
+ * not pull in any inline code (e.g. OpenCV headers) that could end up compiled with instructions the CPU does not support.
+ */
+
+// Sample positions and interpolation weights of the 8 neighbors
+struct LbpPattern8
+{
+	std::ptrdiff_t offsets[8][4];	// Offsets in bytes relative to the center pixel (only the first is used for non interpolated neighbors)
+	double weights[8][4];		// Interpolation weights of the 4 samples
+};
+
+// Computes the LBP codes of the n consecutive pixels starting at p and writes them to codes.
+// Returns the number of pixels processed, which is n or 0 if the kernel is not available or n is too small.
+typedef int (*LbpRowKernel8)(const unsigned char* p, int n, const LbpPattern8& pattern, bool interpolate_diagonals, unsigned char* codes);
+
+int lbp_8_1_row_sse41(const unsigned char* p, int n, const LbpPattern8& pattern, bool interpolate_diagonals, unsigned char* codes);
+int lbp_8_1_row_avx2(const unsigned char* p, int n, const LbpPattern8& pattern, bool interpolate_diagonals, unsigned char* codes);
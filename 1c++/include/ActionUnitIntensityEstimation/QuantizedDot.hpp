@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Vectorized dot products of the quantized AU regression (see AUIntensityEstimation::set_quantization()): 16 bit LBP
+ * histogram counts times 16 or 8 bit weights, accumulated in 32 bit integers. Like the kernels in LbpSimd.hpp, each kernel
+ * is compiled for its instruction set in its own translation unit and selected at runtime.
+ * The counts of a histogram bin can exceed 255, so the 8 bit weights are sign extended and use the same 16 bit
+ * multiply-add as the 16 bit weights (they only save memory bandwidth).
+ */
+
+// Adds the dot product of the first elements of hist and weights to sum (the caller makes sure it does not overflow).
+// Returns the number of elements processed, which is a multiple of 16 (0 if the kernel is not available).
+typedef int (*QuantizedDot16)(const int16_t* hist, const int16_t* weights, int n, int32_t& sum);
+typedef int (*QuantizedDot8)(const int16_t* hist, const int8_t* weights, int n, int32_t& sum);
+
+int quantized_dot16_sse41(const int16_t* hist, const int16_t* weights, int n, int32_t& sum);
+int quantized_dot16_avx2(const int16_t* hist, const int16_t* weights, int n, int32_t& sum);
+int quantized_dot8_sse41(const int16_t* hist, const int8_t* weights, int n, int32_t& sum);
+int quantized_dot8_avx2(const int16_t* hist, const int8_t* weights, int n, int32_t& sum);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <string>
+#include "SpscRingBuffer.hpp"
+
+/// Decodes a video in a background thread and converts the frames to dlib RGB images.
+/// Frames are passed to the consumer through a bounded lock-free ring buffer, so decoding and processing overlap.
+class AsyncVideoDecoder
+{
+public:
+	typedef dlib::matrix<dlib::rgb_pixel> image_type;
+
+	/// Open video and start decoding (check is_opened() afterwards)
+	AsyncVideoDecoder(const std::string & filename, size_t buffer_size = 32);
+
+	/// Stop decoding and wait for the decoding thread
+	~AsyncVideoDecoder();
+
+	bool is_opened() const { return m_opened; }
+
+	/// Get the next frame. Blocks until a frame is available, returns false at the end of the video.
+	/// Exceptions of the decoding thread (e.g. cv::Exception) are rethrown after the frames decoded before.
+	/// The previous content of img is recycled by the decoding thread.
+	bool read(image_type & img);
+
+private:
+	void decode();
+
+	cv::VideoCapture m_vid;
+	bool m_opened;
+	SpscRingBuffer<image_type> m_buffer;
+	std::atomic<bool> m_finished;
+	std::atomic<bool> m_stop;
+	std::exception_ptr m_error;	// Exception of the decoding thread
+	std::thread m_thread;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <dlib/geometry.h>
+#include "ResultStore.hpp"
+
+/* Checkpoint of an extraction stage (e.g. xxx_AUOld.checkpoint), so a rerun only processes the videos whose inputs changed.
+ * Text file: the first line is the key of the models and settings of the stage, followed by one line "vid_id key" per
+ * finished video. The key of a video combines the size and modification time of the video file with a hash of its other
+ * inputs (e.g. its face detections). Lines are appended when a video is finished, the last line of a video counts.
+ */
+class Checkpoint
+{
+public:
+	/// Load the checkpoint of the previous run (ignored if it was made with another models key or reuse is false)
+	Checkpoint(const std::string & filename, const std::string & models_key, bool reuse = true);
+
+	/// Whether video vid_id was finished by the previous run with the same key
+	bool is_done(long vid_id, const std::string & key) const;
+
+	/// Start recording the current run: the file is rewritten with the videos that are reused from the previous run
+	bool start(const std::vector<std::string> & keys, const std::vector<bool> & reused);
+
+	/// Record that video vid_id is finished (thread-safe, the line is written immediately)
+	void set_done(long vid_id, const std::string & key);
+
+	/// Key of a file from its size and modification time ("-" if it does not exist)
+	static std::string file_key(const std::string & filename);
+
+	/// Key of a file from a hash of its content, e.g. for model files ("-" if it does not exist)
+	static std::string content_key(const std::string & filename);
+
+	/// Key of a block of data from its hash
+	static std::string data_key(const void * data, size_t size);
+
+private:
+	std::string m_filename;
+	std::string m_models_key;
+	std::map<long, std::string> m_previous;
+	std::ofstream m_file;
+	std::mutex m_mutex;
+};
+
+/// Keys of the inputs of all videos: key of the video file and (if given) of its face detections
+std::vector<std::string> video_input_keys(const std::vector<std::string> & filename_list, const std::vector<std::vector<dlib::rectangle>> * face_dets_list = NULL);
+
+/// Read the results of the videos that are done according to checkpoint from the result store of the previous run
+/// (which may be incomplete). reused[vid_id] is set for these videos. Returns true if all videos are reused and the store
+/// is complete, i.e., the stage does not need to run at all.
+bool read_reused_results(const Checkpoint & checkpoint, const std::vector<std::string> & keys, const std::string & store_filename,
+	const std::vector<ResultColumn> & columns, std::vector<ResultVideo> & videos, std::vector<bool> & reused);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <opencv2/core/core.hpp>
+
+#include <FaceBase/FaceDetectorDlib.hpp>
+#include <ActionUnitIntensityEstimation/AU.hpp>
+
+#include "ExtractionOptions.hpp"
+
+// Loading of the models shared by the extraction stages and FacialActivityExtractor (exdata_dir ends with '/')
+
+/// Create and load the face detector backend selected by name ("cnn" or "hog"), defined in detectFace.cpp
+cv::Ptr<FaceDetectorDlib> createFaceDetector(const std::string& name, const std::string& exdata_dir);
+
+/// Load the AU model from exdata_dir (binary model file, converted from the text files if needed), defined in detectAUsOld.cpp
+void loadAUModel(const std::string& exdata_dir, AUIntensityEstimation& AU);
+
+/// Apply the AU estimation settings of the command line options to a loaded model, defined in detectAUsOld.cpp
+void configureAUModel(const ExtractionOptions& options, AUIntensityEstimation& AU);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+
+// Optional command line settings of the feature extraction (see help() in main.cpp).
+struct ExtractionOptions
+{
+	// Decode each video only once and run face detection, AU estimation, and face recognition in a single pass
+	bool fused = false;
+
+	// Number of videos that are processed in parallel (each thread has its own copy of all models)
+	long jobs = 1;
+
+	// Face detection backend: "cnn" (dlib MMOD network, needs CUDA to be fast) or "hog" (dlib HOG detector, fast on the CPU)
+	std::string detector = "cnn";
+
+	// Face detection: decode the video in a separate thread that feeds the detector through a ring buffer
+	bool async_decode = false;
+
+	// Face detection: run the face detector only on every keyframe_interval-th frame and track the face in between (1 = no tracking)
+	long keyframe_interval = 1;
+	// Face detection: re-run the face detector if the tracking confidence (peak-to-sidelobe ratio) drops below this threshold
+	double min_tracking_confidence = 7.0;
+	// Face detection: run the face detector on a region of roi_scale times the previous face box size first (0 = full frame only)
+	double roi_scale = 0.0;
+
+	// Face registration: estimate the affine transform with the general SVD solver instead of the closed form solution
+	bool affine_svd = false;
+	// Face registration: warp only the gray values of the face for AU estimation (differs from the color warp by rounding)
+	bool gray_warp = false;
+
+	// AU estimation: normalize the features before the regression instead of using the regression model with folded normalization
+	bool au_unfolded = false;
+	// AU estimation: quantized regression model "int16" or "int8" (see AUIntensityEstimation::set_quantization()), "none" = float.
+	// The quantized model is derived from the folded model and cannot be combined with au_unfolded.
+	std::string au_quantization = "none";
+
+	// Process all videos again, even those whose inputs and models did not change since the last run (see Checkpoint.hpp)
+	bool recompute = false;
+
+	// Export the binary result files (xxx_facedet.bin, xxx_AUOld.bin) as text files for the matlab importer
+	bool export_csv = true;
+
+	// Write the run time of the stages, videos, and sections as JSON (empty = no profiling, see Profiler.hpp)
+	std::string profile_file;
+	// Write all timed sections as Chrome trace events (empty = no trace)
+	std::string trace_file;
+
+	// Instead of the feature extraction, compare the quantized AU estimation with the float model on the given videos
+	bool au_calibrate = false;
+};
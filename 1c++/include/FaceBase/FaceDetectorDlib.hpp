@@ -0,0 +1,54 @@
+#pragma once
+
+#include <FaceBase/FaceDetector2D.hpp>
+#include <dlib/image_processing.h>
+#include <dlib/image_processing/full_object_detection.h>
+#include <dlib/dnn.h>
+#include <dlib/matrix.h>
+#include <dlib/opencv.h>
+#include <vector>
+#include <algorithm>
+
+/// Base class for dlib face detectors. Besides the opencv interface of FaceDetector2D, it works on dlib images directly
+/// (no conversion per frame) and returns the detections with their confidence.
+class FaceDetectorDlib : public FaceDetector2D
+{
+	std::string detector_name;
+public:
+	typedef dlib::matrix<dlib::rgb_pixel> image_type;
+
+	FaceDetectorDlib(const char * name) : detector_name(name) {}
+
+	/// Get name of detector
+	const char * get_name() const { return detector_name.c_str(); }
+
+	/// Copy of the detector that can be used in another thread
+	virtual cv::Ptr<FaceDetectorDlib> clone() const = 0;
+
+	/// Detect faces in one image
+	virtual void detect(const image_type & img, std::vector<dlib::mmod_rect> & dets) const = 0;
+
+	/// Detect faces in several images (backends that support batch processing override this)
+	virtual void detect(const std::vector<image_type> & imgs, std::vector<std::vector<dlib::mmod_rect>> & dets) const
+	{
+		dets.resize(imgs.size());
+		for (size_t i = 0; i < imgs.size(); ++i)
+			detect(imgs[i], dets[i]);
+	}
+
+	/// Detect faces in opencv BGR image, sorted by descending confidence
+	virtual bool detect_faces(const cv::Mat & img, std::vector<cv::Rect> & face_bboxs) const
+	{
+		image_type dlib_img;
+		dlib::assign_image(dlib_img, dlib::cv_image<dlib::bgr_pixel>(img));
+
+		std::vector<dlib::mmod_rect> dets;
+		detect(dlib_img, dets);
+		std::sort(dets.begin(), dets.end(), [](const dlib::mmod_rect& left, const dlib::mmod_rect& right) {return(right.detection_confidence < left.detection_confidence); });
+
+		face_bboxs.clear();
+		for (const auto & det : dets)
+			face_bboxs.push_back(cv::Rect(det.rect.left(), det.rect.top(), det.rect.width(), det.rect.height()));
+		return !face_bboxs.empty();
+	}
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <FaceBase/FaceDetectorDlib.hpp>
+#include <FaceBase/DlibNetworks.hpp>
+
+/// dlib's max-margin object detection CNN (mmod_human_face_detector.dat). Very robust, but slow without CUDA.
+class FaceDetectorDlibCNN : public FaceDetectorDlib
+{
+	// The forward pass changes the internal state of the network
+	mutable dlib_networks::net_type m_net;
+public:
+	FaceDetectorDlibCNN() : FaceDetectorDlib("CNN") {}
+
+	bool load(const char * model_fn = "mmod_human_face_detector.dat")
+	{
+		try
+		{
+			dlib::deserialize(model_fn) >> m_net;
+			return true;
+		}
+		catch(...)
+		{
+			return false;
+		}
+	}
+
+	cv::Ptr<FaceDetectorDlib> clone() const
+	{
+		return cv::Ptr<FaceDetectorDlib>(new FaceDetectorDlibCNN(*this));
+	}
+
+	void detect(const image_type & img, std::vector<dlib::mmod_rect> & dets) const
+	{
+		dets = m_net(img);
+	}
+
+	void detect(const std::vector<image_type> & imgs, std::vector<std::vector<dlib::mmod_rect>> & dets) const
+	{
+		dets = m_net(imgs);
+	}
+};
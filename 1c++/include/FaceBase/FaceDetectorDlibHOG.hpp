@@ -0,0 +1,34 @@
+#pragma once
+
+#include <FaceBase/FaceDetectorDlib.hpp>
+#include <dlib/image_processing/frontal_face_detector.h>
+
+/// dlib's HOG + linear SVM frontal face detector. Runs fast on the CPU, but is less robust than the CNN.
+class FaceDetectorDlibHOG : public FaceDetectorDlib
+{
+	mutable dlib::frontal_face_detector m_detector;
+public:
+	FaceDetectorDlibHOG() : FaceDetectorDlib("HOG") {}
+
+	/// The model is built into dlib, so model_fn is ignored
+	bool load(const char * model_fn = 0)
+	{
+		m_detector = dlib::get_frontal_face_detector();
+		return true;
+	}
+
+	cv::Ptr<FaceDetectorDlib> clone() const
+	{
+		return cv::Ptr<FaceDetectorDlib>(new FaceDetectorDlibHOG(*this));
+	}
+
+	void detect(const image_type & img, std::vector<dlib::mmod_rect> & dets) const
+	{
+		std::vector<dlib::rect_detection> rect_dets;
+		m_detector(img, rect_dets);
+
+		dets.clear();
+		for (const auto & det : rect_dets)
+			dets.push_back(dlib::mmod_rect(det.rect, det.detection_confidence));
+	}
+};
@@ -6,11 +6,24 @@
 class FaceRegistrationAffineMeanShape : public FaceRegistration
 {
 	std::vector<cv::Point2f> mean_shape;
+	cv::Point2d mean_shape_center;
 	cv::Size output_size;
+	bool closed_form;
+
+	// Grayscale source region of register_face_gray(). Not shared by copies (e.g. the model copies of several threads).
+	struct SourceBuffer
+	{
+		cv::Mat gray;
+		SourceBuffer() {}
+		SourceBuffer(const SourceBuffer &) {}
+		SourceBuffer & operator=(const SourceBuffer &) { return *this; }
+	} source_buffer;
+
+	cv::Mat estimate_transform(const std::vector<cv::Point2f> & in_landmarks) const;
 
 public:
 
-	FaceRegistrationAffineMeanShape() : FaceRegistration("FaceRegistrationAffineMeanShape") {}
+	FaceRegistrationAffineMeanShape() : FaceRegistration("FaceRegistrationAffineMeanShape"), closed_form(true) {}
 
 	/*!
 	 *	\brief Load mean shape model
@@ -23,5 +36,12 @@ public:
 	/// Register face, needs landmarks coordinates inside image, returns transformed image and/or landmarks if needed
 	bool register_face(const std::vector<cv::Point2f> & in_landmarks, const cv::Mat & in_image, cv::Mat * transformed_image = NULL, std::vector<cv::Point2f> * transformed_landmarks = NULL);
 
+	/// Register face to an 8 bit grayscale image (e.g. for AU estimation). Only the source region covered by the output is converted
+	/// to grayscale, and a single channel is warped. The gray values differ from cvtColor() of the register_face() output by rounding.
+	bool register_face_gray(const std::vector<cv::Point2f> & in_landmarks, const cv::Mat & in_image, cv::Mat & transformed_image, std::vector<cv::Point2f> * transformed_landmarks = NULL);
+
+	/// Estimate the affine transform with the closed-form least squares solution (default) or with the general SVD solver (previous behaviour)
+	void set_closed_form(bool enable) { closed_form = enable; }
+
 	bool visualize_landmarks(cv::Mat & image, const std::vector<cv::Point2f> & landmark, bool mean_shape = true);
 };
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <dlib/image_processing.h>
+#include <dlib/image_processing/correlation_tracker.h>
+#include <dlib/matrix.h>
+#include <vector>
+#include <FaceBase/FaceDetectorDlib.hpp>
+
+/// Face detection in consecutive frames of a video.
+/// By default, the face detector (e.g. the CNN) is applied to every frame (in batches). In tracking mode (keyframe_interval > 1), the
+/// detector only runs on every keyframe_interval-th frame or if the tracking confidence drops below min_tracking_confidence.
+/// In between, the face box is propagated with a correlation tracker, which is much cheaper than the detector.
+/// In ROI mode (roi_scale > 0), the detector first searches an enlarged region around the previous face box and only falls back
+/// to the full frame if no face is found there.
+class VideoFaceDetector
+{
+public:
+	typedef dlib::matrix<dlib::rgb_pixel> image_type;
+
+	/*!
+	 *	\param detector				Face detector backend (not copied, must not be used by other threads at the same time)
+	 *	\param keyframe_interval		Run the detector at least on every keyframe_interval-th frame (1 = every frame, no tracking)
+	 *	\param min_tracking_confidence	Run the detector if the peak-to-sidelobe ratio of the tracker falls below this threshold (drift)
+	 *	\param roi_scale				Size of the search region relative to the previous face box (0 = always search the full frame)
+	 */
+	VideoFaceDetector(const FaceDetectorDlib & detector, long keyframe_interval = 1, double min_tracking_confidence = 7.0, double roi_scale = 0.0);
+
+	/// Prepare for a new video
+	void reset();
+
+	/// Detect the face in each of the consecutive frames (empty rectangle if no face was found)
+	void detect(const std::vector<image_type> & images, std::vector<dlib::rectangle> & faces);
+
+	/// Number of frames processed by the detector resp. the tracker since the last reset()
+	long num_detector_frames() const { return m_num_detector_frames; }
+	long num_tracked_frames() const { return m_num_tracked_frames; }
+	/// Number of detector frames in which the face was found within the region of interest (no full frame search needed)
+	long num_roi_frames() const { return m_num_roi_frames; }
+
+	/// Select the detection with the highest confidence (empty rectangle if dets is empty)
+	static dlib::rectangle best_detection(std::vector<dlib::mmod_rect> & dets);
+
+private:
+	dlib::rectangle detect_single(const image_type & img);
+
+	const FaceDetectorDlib & m_detector;
+	long m_keyframe_interval;
+	double m_min_tracking_confidence;
+	double m_roi_scale;
+
+	dlib::correlation_tracker m_tracker;
+	bool m_tracking;
+	dlib::rectangle m_last_face;
+	image_type m_roi_image;
+	std::vector<std::vector<dlib::mmod_rect>> m_detection_list;	// Detections of the last batch (buffer reused for every batch)
+	long m_frames_since_detection;
+	long m_num_detector_frames;
+	long m_num_tracked_frames;
+	long m_num_roi_frames;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <dlib/dnn.h>
+#include <dlib/image_processing.h>
+
+#include <FaceBase/DlibNetworks.hpp>
+#include <FaceBase/FaceDetectorDlib.hpp>
+#include <FaceBase/VideoFaceDetector.hpp>
+#include <FaceBase/FaceRegistrationAffineMeanShape.hpp>
+#include <ActionUnitIntensityEstimation/AU.hpp>
+
+#include "ExtractionOptions.hpp"
+
+/// Results of FacialActivityExtractor for one video (only the requested outputs are filled)
+struct FacialActivity
+{
+	typedef dlib::matrix<float, 0, 1> descriptor_type;
+
+	long num_frames = 0;
+
+	// OUTPUT_FACES: Face box of each frame (empty rectangle if no face was found)
+	std::vector<dlib::rectangle> faces;
+
+	// OUTPUT_LANDMARKS: 68 landmarks of each frame
+	std::vector<dlib::full_object_detection> landmarks;
+
+	// OUTPUT_AUS: AU intensities, one row per frame and one column per AU (CV_32F), AU_ids as in AUIntensityEstimation::get_AUIds()
+	cv::Mat AU_intensities;
+	cv::Mat AU_ids;
+
+	// OUTPUT_IDENTITY: 128D face descriptors of every 4th of the first 200 frames (as in recognizeFaces()) and the face chip of the first frame
+	std::vector<descriptor_type> face_descriptors;
+	dlib::matrix<dlib::rgb_pixel> first_face;
+};
+
+/* In-process facial activity extraction, the single pass pipeline of extractFeaturesFused() without files.
+ * The models are loaded once from exdata_dir; afterwards any number of videos can be processed, either from a file or
+ * frame by frame (e.g. from a camera or a decoder of the embedding application):
+ *   FacialActivityExtractor extractor(exdata_dir, options);
+ *   FacialActivity activity = extractor.process_video(filename);
+ * or
+ *   extractor.begin_video(FacialActivityExtractor::OUTPUT_AUS);
+ *   while (...) extractor.push_frame(bgr_frame);
+ *   FacialActivity activity = extractor.end_video();
+ * An extractor processes one video at a time and must not be used by several threads. For parallel processing, copy it
+ * (the copy shares no state with the original, the models are copied instead of loaded again).
+ * The stages detectAUsOld() and recognizeFaces() of the command line program do not use it: they read the stored face
+ * detections and landmark cache, resume from checkpoints, and estimate AUs in batches of 32 frames. The stages
+ * load the face detector and the AU model with the same functions as the extractor (see ExtractionModels.hpp).
+ */
+class FacialActivityExtractor
+{
+public:
+	enum Output
+	{
+		OUTPUT_FACES = 1,
+		OUTPUT_LANDMARKS = 2,
+		OUTPUT_AUS = 4,
+		OUTPUT_IDENTITY = 8,
+		OUTPUT_ALL = 15
+	};
+
+	// Frames that are processed at once (face detection and AU estimation), same as in detectFace()
+	static const size_t batch_size = 15;
+
+	/// Load all models from exdata_dir (see README), throws dlib::fatal_error if a model cannot be loaded
+	FacialActivityExtractor(const std::string & exdata_dir, const ExtractionOptions & options = ExtractionOptions());
+	FacialActivityExtractor(const FacialActivityExtractor & other);
+	FacialActivityExtractor & operator=(const FacialActivityExtractor &) = delete;
+
+	/// Start a new video, outputs is a combination of Output flags (the face detections are always computed)
+	void begin_video(int outputs = OUTPUT_ALL);
+
+	/// Add the next frame of the current video (8 bit BGR image as read by cv::VideoCapture). The frames are processed in batches.
+	void push_frame(const cv::Mat & frame);
+
+	/// Process the remaining frames and return the results of the current video. Afterwards, the next video can be started.
+	FacialActivity end_video();
+
+	/// Decode and process a video file, throws dlib::fatal_error if the video cannot be opened
+	FacialActivity process_video(const std::string & filename, int outputs = OUTPUT_ALL);
+
+	/// Number of landmarks of the shape predictor (68)
+	long num_landmarks() const { return m_sp.num_parts(); }
+
+	/// Number of AUs (columns of FacialActivity::AU_intensities)
+	int num_AUs() const { return m_AU.get_AUIds().total(); }
+
+	/// Cluster the face descriptors of several videos into num_identities identities (label of each video, see clusterFaces())
+	static std::vector<unsigned long> cluster_identities(const std::vector<std::vector<FacialActivity::descriptor_type>> & face_descriptors, long num_identities);
+
+private:
+	typedef dlib::matrix<dlib::rgb_pixel> image_type;
+
+	void init();
+	void add_buffered_frame();
+	void process_batch();
+
+	ExtractionOptions m_options;
+
+	// Models
+	cv::Ptr<FaceDetectorDlib> m_detector;
+	dlib::shape_predictor m_sp;
+	FaceRegistrationAffineMeanShape m_face_reg;
+	AUIntensityEstimation m_AU;
+	dlib_networks::face_rec_net_type m_face_rec_net;
+
+	// Current video
+	int m_outputs;
+	cv::Ptr<VideoFaceDetector> m_video_face_detector;
+	AUIntensityEstimation::Workspace m_AU_workspace;
+	size_t m_num_buffered;
+	std::vector<cv::Mat> m_cv_images;
+	std::vector<image_type> m_images;
+	std::vector<dlib::rectangle> m_faces_det;
+	std::vector<cv::Point2f> m_landmarks68, m_landmarks49;
+	std::vector<cv::Mat> m_faces_registered;
+	std::vector<std::vector<cv::Point2f>> m_landmarks49_registered;
+	cv::Mat m_AU_detections;
+	std::vector<image_type> m_face_chips;
+	FacialActivity m_activity;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+#include <stdint.h>
+#include <dlib/image_processing/full_object_detection.h>
+#include "misc.hpp"
+
+/* Binary sidecar file with the facial landmarks of all frames of all videos (xxx_landmarks.bin).
+ * It is written by the AU estimation, so later stages do not have to run the shape predictor again.
+ * Layout (little endian, see BinaryFile):
+ *   uint32 magic, uint32 version, uint32 num_videos, uint32 num_points
+ *   for each video in vid_id order: uint32 vid_id, uint32 num_frames, int16 x0 y0 x1 y1 ... (num_frames * num_points * 2 values)
+ * dlib landmarks have integer coordinates, so int16 stores them exactly.
+ */
+class LandmarkCacheWriter
+{
+public:
+	LandmarkCacheWriter(const std::string & filename, long num_videos, long num_points = 68);
+	~LandmarkCacheWriter() { close(); }
+
+	bool is_open() const { return m_file != NULL; }
+
+	/// Append the landmarks of one frame to the buffer of a video
+	static void append(const dlib::full_object_detection & shape, std::vector<int16_t> & video_points);
+
+	/// Write the landmarks of video vid_id. Thread-safe; videos may be passed in any order, they are written in vid_id order.
+	void write(long vid_id, std::vector<int16_t> video_points);
+
+	/// Close file, returns false if any write failed
+	bool close();
+
+private:
+	std::FILE * m_file;
+	long m_num_points;
+	bool m_okay;
+	misc::OrderedCommit m_commit;
+};
+
+class LandmarkCacheReader
+{
+public:
+	/// Open file and index the video blocks (check is_open() afterwards)
+	LandmarkCacheReader(const std::string & filename);
+	~LandmarkCacheReader();
+
+	bool is_open() const { return m_file != NULL; }
+	long num_videos() const { return m_offsets.size(); }
+	long num_points() const { return m_num_points; }
+	long num_frames(long vid_id) const { return m_num_frames.at(vid_id); }
+
+	/// Read the landmarks of all frames of video vid_id (thread-safe)
+	bool read(long vid_id, std::vector<int16_t> & video_points);
+
+	/// Get landmarks of frame frame_no as dlib shape (as returned by the shape predictor for the face rectangle rect)
+	dlib::full_object_detection get_shape(const std::vector<int16_t> & video_points, long frame_no, const dlib::rectangle & rect) const;
+
+private:
+	std::FILE * m_file;
+	long m_num_points;
+	std::vector<long> m_offsets;
+	std::vector<long> m_num_frames;
+	std::mutex m_mutex;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/// Read-only memory mapping of a whole file. Uses mmap on POSIX systems; elsewhere the file is read into memory.
+/// The data is at least 8 byte aligned.
+class MemoryMappedFile
+{
+public:
+	MemoryMappedFile() : m_data(NULL), m_size(0), m_mapped(false) {}
+	~MemoryMappedFile() { close(); }
+
+	MemoryMappedFile(const MemoryMappedFile&) = delete;
+	MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+	/// Map file (closes the previous one), returns false if the file cannot be opened or is empty
+	bool open(const std::string & filename);
+	void close();
+
+	bool is_open() const { return m_data != NULL; }
+	const unsigned char * data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	const unsigned char * m_data;
+	size_t m_size;
+	bool m_mapped;
+	std::vector<double> m_buffer;	// Used if mmap is not available (double for alignment)
+};
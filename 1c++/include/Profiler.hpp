@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+
+/* Lightweight instrumentation of the extraction (enabled at runtime with --profile / --trace, see main.cpp).
+ * Timers measure named sections (e.g. "decode", "shape_predictor") of the current stage and video:
+ *   profiler::StageScope stage("detectAUsOld");      // main thread, around a stage
+ *   profiler::VideoScope video(vid_id);              // worker thread, around a video
+ *   { profiler::Timer timer("register_face"); ... }  // any section within a video
+ *   profiler::add_frames(1);                         // frames of the current video
+ * write_summary() writes latency percentiles (p50/p95/p99) and frames/sec per stage, section, and video as JSON,
+ * write_trace() all timed sections in the Chrome trace event format (chrome://tracing, only if enabled with trace = true).
+ * If the profiler is disabled, the scopes only check a flag.
+ */
+namespace profiler
+{
+	/// Enable recording. With trace = true, all sections are kept for write_trace() (needs memory for long runs).
+	void enable(bool trace = false);
+	bool is_enabled();
+
+	class Timer
+	{
+	public:
+		/// name must be a string literal (it is stored as pointer)
+		Timer(const char * name);
+		~Timer() { stop(); }
+
+		/// Stop the timer before the end of the scope (e.g. for the decoding in a loop condition)
+		void stop();
+
+	private:
+		const char * m_name;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	class VideoScope
+	{
+	public:
+		/// Collect the sections and frames of the calling thread as those of video vid_id
+		VideoScope(long vid_id);
+		~VideoScope();
+
+	private:
+		bool m_enabled;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	class StageScope
+	{
+	public:
+		/// Start stage name (the stages must run one after the other)
+		StageScope(const std::string & name);
+		~StageScope();
+
+	private:
+		bool m_enabled;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	/// Add frames to the current video (or stage if called outside of a video)
+	void add_frames(long num_frames);
+
+	/// Write summary of all stages as JSON, returns false if the file cannot be written
+	bool write_summary(const std::string & filename);
+
+	/// Write all timed sections as Chrome trace events, returns false if the file cannot be written
+	bool write_trace(const std::string & filename);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+#include <fstream>
+#include <stdint.h>
+#include "misc.hpp"
+
+/* Binary columnar store of the per-frame results of all videos (xxx_facedet.bin, xxx_AUOld.bin).
+ * It replaces the text files of the stages, export_result_csv() writes the text format read by the matlab importer.
+ * Layout (little endian, see BinaryFile):
+ *   uint32 magic, uint32 version, uint32 num_videos, uint32 num_columns
+ *   for each column: uint32 type, uint32 width (values per frame), uint32 name length, name characters
+ *   for each video in vid_id order: for each column: num_frames * width values (the values of a column are contiguous)
+ *   index: for each video: uint64 offset of its block, uint32 num_frames
+ *   uint64 offset of the index
+ * The index is written last, so files of aborted runs are not valid.
+ * While the file is written, a text manifest (xxx.bin.manifest) lists the videos already written ("vid_id offset num_frames"
+ * per line). The videos of an aborted run can be recovered from it, the manifest is removed when the file is complete.
+ */
+struct ResultColumn
+{
+	enum Type { INT16 = 0, INT32 = 1, FLOAT32 = 2 };
+
+	ResultColumn(const std::string & name = "", Type type = FLOAT32, long width = 1) : name(name), type(type), width(width) {}
+
+	bool operator==(const ResultColumn & other) const { return name == other.name && type == other.type && width == other.width; }
+
+	/// Size of one value in bytes
+	size_t value_size() const { return type == INT16 ? 2 : 4; }
+
+	std::string name;
+	Type type;
+	long width;
+};
+
+/// Columns of xxx_facedet.bin (face box: left, top, width, height)
+std::vector<ResultColumn> face_detection_columns();
+
+/// Columns of xxx_AUOld.bin (intensities of num_AUs action units)
+std::vector<ResultColumn> au_columns(long num_AUs);
+
+/// Results of the frames of one video, column by column
+class ResultVideo
+{
+public:
+	ResultVideo(const std::vector<ResultColumn> & columns);
+
+	/// Append the values of one frame (width values) to a column, the type must match the column type
+	void append(size_t column, const int16_t * values);
+	void append(size_t column, const int32_t * values);
+	void append(size_t column, const float * values);
+
+	/// Number of frames (of the first column)
+	long num_frames() const;
+
+private:
+	void append(size_t column, ResultColumn::Type type, const void * values);
+
+	friend class ResultStoreWriter;
+	friend class ResultStoreReader;
+	std::vector<ResultColumn> m_columns;
+	std::vector<std::vector<char>> m_data;	// Values of each column in host byte order
+};
+
+class ResultStoreWriter
+{
+public:
+	ResultStoreWriter(const std::string & filename, long num_videos, const std::vector<ResultColumn> & columns);
+	~ResultStoreWriter() { close(); }
+
+	bool is_open() const { return m_file != NULL; }
+
+	/// Write the results of video vid_id. Thread-safe; videos may be passed in any order, they are written in vid_id order.
+	void write(long vid_id, ResultVideo video);
+
+	/// Write the index and close the file, returns false if any write failed or not all videos were written.
+	/// The manifest is kept if the file is incomplete.
+	bool close();
+
+private:
+	std::FILE * m_file;
+	std::string m_manifest_filename;
+	std::ofstream m_manifest;
+	long m_num_videos;
+	std::vector<ResultColumn> m_columns;
+	std::vector<uint64_t> m_offsets;
+	std::vector<uint32_t> m_num_frames;
+	bool m_okay;
+	misc::OrderedCommit m_commit;
+};
+
+class ResultStoreReader
+{
+public:
+	/// Open file and read the index (check is_open() afterwards). With recover = true, the videos of an incomplete file
+	/// are read from its manifest (see has_video()).
+	ResultStoreReader(const std::string & filename, bool recover = false);
+	~ResultStoreReader();
+
+	bool is_open() const { return m_file != NULL; }
+	/// Whether the file is complete (not recovered from the manifest)
+	bool is_complete() const { return m_complete; }
+	long num_videos() const { return m_offsets.size(); }
+	/// Whether the results of video vid_id are in the file (always true for complete files)
+	bool has_video(long vid_id) const { return m_offsets.at(vid_id) >= 0; }
+	long num_frames(long vid_id) const { return m_num_frames.at(vid_id); }
+	const std::vector<ResultColumn> & columns() const { return m_columns; }
+
+	/// Index of the column with the given name, -1 if there is none
+	long column(const std::string & name) const;
+
+	/// Read all values of a column of video vid_id (num_frames * width values, thread-safe). Fails if the type does not match.
+	bool read(long vid_id, size_t column, std::vector<int16_t> & values);
+	bool read(long vid_id, size_t column, std::vector<int32_t> & values);
+	bool read(long vid_id, size_t column, std::vector<float> & values);
+
+	/// Read all columns of video vid_id (thread-safe)
+	bool read(long vid_id, ResultVideo & video);
+
+private:
+	template <typename T>
+	bool read_column(long vid_id, size_t column, ResultColumn::Type type, std::vector<T> & values);
+
+	std::FILE * m_file;
+	bool m_complete;
+	std::vector<ResultColumn> m_columns;
+	std::vector<long> m_offsets;
+	std::vector<long> m_num_frames;
+	std::mutex m_mutex;
+};
+
+/// Read the face detections of all videos from xxx_facedet.bin (fails with an error if the file is invalid)
+void read_face_detections(const std::string & filename, std::vector<std::vector<dlib::rectangle>> & detections);
+
+/// Write a result store as text file with one line per frame (vid_id,frame_no,values of all columns), which is the format
+/// of the former xxx_facedet.txt and xxx_AUOld.txt files. Returns false if the store is invalid or the file cannot be written.
+bool export_result_csv(const std::string & store_filename, const std::string & csv_filename);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/// Bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+/// Elements are exchanged by swapping, so the buffers of large elements (e.g. images) are recycled instead of reallocated.
+template <typename T>
+class SpscRingBuffer
+{
+public:
+	explicit SpscRingBuffer(size_t capacity) : m_slots(capacity + 1), m_head(0), m_tail(0) {}
+
+	/// Producer: Swap item into the buffer (item receives the recycled content of the slot). Returns false if the buffer is full.
+	bool try_push(T & item)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t next = increment(tail);
+		if (next == m_head.load(std::memory_order_acquire))
+			return false;
+
+		using std::swap;
+		swap(m_slots[tail], item);
+		m_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	/// Consumer: Swap the oldest element out of the buffer into item. Returns false if the buffer is empty.
+	bool try_pop(T & item)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+
+		using std::swap;
+		swap(m_slots[head], item);
+		m_head.store(increment(head), std::memory_order_release);
+		return true;
+	}
+
+	size_t capacity() const { return m_slots.size() - 1; }
+
+private:
+	size_t increment(size_t i) const { return i + 1 == m_slots.size() ? 0 : i + 1; }
+
+	std::vector<T> m_slots;
+	// Head and tail are on separate cache lines to avoid false sharing between producer and consumer
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+};
@@ -4,6 +4,9 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <chrono>
+#include <mutex>
+#include <functional>
 #include <opencv2/core/core.hpp>
 #include <dlib/geometry.h>
 
@@ -16,6 +19,33 @@ namespace misc
     
     void read_face_detection(const std::string& filename, std::vector<std::vector<dlib::rectangle>>& detections);
     void read_face_detection(const std::string& filename, std::vector<dlib::rectangle>& detections);
+
+    // Mutex for console output of concurrently processed videos
+    std::mutex& output_mutex();
+
+    // Print progress line of a video ("n/N. Approx. m minutes left. Processing video: ..."), thread-safe
+    void print_progress(const std::chrono::steady_clock::time_point& time_start, long vid_id, long num_videos, const std::string& filename);
+
+    // Call fn(job_id, vid_id) for all vid_id in [0, num_videos) using num_jobs threads (job_id in [0, num_jobs)).
+    // Each idle thread takes the next unprocessed video, so videos are started in vid_id order. num_jobs <= 1 runs in the calling thread.
+    // The first exception thrown by fn stops the distribution of further videos and is rethrown after all threads finished.
+    void parallel_for_videos(long num_jobs, long num_videos, const std::function<void(long job_id, long vid_id)>& fn);
+
+    // Runs the functions submitted for videos that finish in arbitrary order in vid_id order (e.g. to write their results)
+    class OrderedCommit
+    {
+    public:
+	OrderedCommit() : m_next_vid_id(0) {}
+
+	// Submit fn of video vid_id (each vid_id in [0, num_videos) must be submitted exactly once)
+	void commit(long vid_id, std::function<void()> fn);
+
+    private:
+	long m_next_vid_id;
+	std::map<long, std::function<void()>> m_pending;
+	std::mutex m_mutex;
+    };
+
 //     int crop_face_from_bbox(const cv::Mat& input, const cv::Rect& bbox, const cv::Size& size, cv::Mat& output);
 //     
 //     struct Identifier
@@ -6,31 +6,356 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <cmath>
 #include <cstdio>
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <BinaryFile/BinaryFile.hpp>
+#include "Profiler.hpp"
 #define PI 3.14159265358979323846
 
+namespace {
+
+// Binary model file (see AUIntensityEstimation::save()):
+//   uint32 magic, uint32 version,
+//   uint32 lbp_num_blocks_x, lbp_num_blocks_y, lbp_neighbors, lbp_radius, lbp_samples, lbp_num,
+//   cv::Mat lbp_table, lbp_num_mapping, mean, std_inv, AUIds, rho, wt (all CV_32FC1, written with BinaryFile::write_one()),
+//   uint32 checksum (FNV-1a of all previous bytes)
+// All fields have a multiple of 4 bytes, so the matrices are properly aligned in the mapped file.
+const uint32_t au_model_magic = 0x4D425541; // "AUBM"
+const uint32_t au_model_version = 1;
+
+uint32_t fnv1a(const unsigned char* data, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+}
+
+// Reads the data written with BinaryFile from memory
+class MappedModelReader
+{
+public:
+	MappedModelReader(const unsigned char* data, size_t size) : m_data(data), m_size(size), m_pos(0), m_okay(true) {}
+
+	bool okay() const { return m_okay; }
+
+	template<typename T>
+	T read()
+	{
+		T value = T();
+		if(!m_okay || m_pos + sizeof(T) > m_size) {
+			m_okay = false;
+			return value;
+		}
+		std::memcpy(&value, m_data + m_pos, sizeof(T));
+		m_pos += sizeof(T);
+		return BinaryFile::is_bigendian() ? BinaryFile::swap_endian(value) : value;
+	}
+
+	// Float matrix pointing to the mapped data (copied on big endian machines only)
+	cv::Mat read_mat()
+	{
+		const int32_t rows = read<int32_t>();
+		const int32_t cols = read<int32_t>();
+		const uint32_t type = read<uint32_t>();
+		const size_t bytes = static_cast<size_t>(rows) * static_cast<size_t>(cols) * sizeof(float);
+		if(!m_okay || rows <= 0 || cols <= 0 || type != CV_32FC1 || m_pos + bytes > m_size) {
+			m_okay = false;
+			return cv::Mat();
+		}
+
+		cv::Mat mat(rows, cols, CV_32FC1, const_cast<unsigned char*>(m_data + m_pos));
+		m_pos += bytes;
+		if(BinaryFile::is_bigendian())
+		{
+			mat = mat.clone();
+			float* p = mat.ptr<float>(0);
+			for(int i = 0; i < rows * cols; i++)
+				p[i] = BinaryFile::swap_endian(p[i]);
+		}
+		return mat;
+	}
+
+private:
+	const unsigned char* m_data;
+	size_t m_size;
+	size_t m_pos;
+	bool m_okay;
+};
+
+}
+
 
 bool AUIntensityEstimation::init(const std::string & feature_model_filename, const std::string & mean_std_filename, const std::string & regressor_filename)
 {
-	return load_feature_model(feature_model_filename) && load_mean_std(mean_std_filename) && load_regression_model(regressor_filename);
+	if(!(load_feature_model(feature_model_filename) && load_mean_std(mean_std_filename) && load_regression_model(regressor_filename)))
+		return false;
+
+	// No matrix points to a previously mapped binary model anymore
+	m_model_file.reset();
+
+	if(!fold_normalization())
+		std::cout << "AU estimation: Folding the feature normalization into the regression model failed, using the unfolded model." << std::endl;
+
+	// Quantize the new model with the same setting
+	if(m_quantization != QUANTIZATION_NONE && !set_quantization(m_quantization))
+		std::cout << "AU estimation: Quantizing the regression model failed, using the float model." << std::endl;
+
+	return true;
+}
+
+bool AUIntensityEstimation::init(const std::string & binary_model_filename)
+{
+	std::shared_ptr<MemoryMappedFile> file = std::make_shared<MemoryMappedFile>();
+	if(!file->open(binary_model_filename) || file->size() < 3 * sizeof(uint32_t))
+		return false;
+
+	// Validate checksum (last 4 bytes)
+	MappedModelReader checksum_reader(file->data() + file->size() - sizeof(uint32_t), sizeof(uint32_t));
+	if(checksum_reader.read<uint32_t>() != fnv1a(file->data(), file->size() - sizeof(uint32_t)))
+	{
+		std::cout << "AU estimation: Checksum mismatch in " << binary_model_filename << std::endl;
+		return false;
+	}
+
+	MappedModelReader reader(file->data(), file->size() - sizeof(uint32_t));
+	if(reader.read<uint32_t>() != au_model_magic || reader.read<uint32_t>() != au_model_version)
+		return false;
+
+	const unsigned int lbp_num_blocks_x = reader.read<uint32_t>();
+	const unsigned int lbp_num_blocks_y = reader.read<uint32_t>();
+	const unsigned int lbp_neighbors = reader.read<uint32_t>();
+	const unsigned int lbp_radius = reader.read<uint32_t>();
+	const unsigned int lbp_samples = reader.read<uint32_t>();
+	const unsigned int lbp_num = reader.read<uint32_t>();
+	const cv::Mat lbp_table = reader.read_mat();
+	const cv::Mat lbp_num_mapping = reader.read_mat();
+	const cv::Mat mean = reader.read_mat();
+	const cv::Mat std_inv = reader.read_mat();
+	const cv::Mat AUIds = reader.read_mat();
+	const cv::Mat rho = reader.read_mat();
+	const cv::Mat wt = reader.read_mat();
+
+	if(!reader.okay() || lbp_num_blocks_x == 0 || lbp_num_blocks_y == 0 || lbp_table.total() != 256 || lbp_num_mapping.total() != 256
+		|| mean.cols != 1 || std_inv.rows != mean.rows || std_inv.cols != 1 || wt.rows != mean.rows
+		|| AUIds.rows != 1 || rho.rows != 1 || AUIds.cols != wt.cols || rho.cols != wt.cols)
+		return false;
+
+	m_init_feat = false;
+	m_init_mean_std = false;
+	m_init_regressor = false;
+
+	m_lbp_num_blocks_x = lbp_num_blocks_x;
+	m_lbp_num_blocks_y = lbp_num_blocks_y;
+	m_lbp_neighbors = lbp_neighbors;
+	m_lbp_radius = lbp_radius;
+	m_lbp_samples = lbp_samples;
+	m_lbp_num = lbp_num;
+	lbp_table.convertTo(m_lbp_table, CV_8UC1);
+	lbp_num_mapping.convertTo(m_lbp_num_mapping, CV_8UC1);
+	AUIds.convertTo(m_AUIds, CV_32SC1);
+
+	// The large matrices point to the (read-only) mapped file, which is kept open as long as any copy of this object exists
+	m_mean = mean;
+	m_std_inv = std_inv;
+	m_rho = rho;
+	m_wt = wt;
+	m_model_file = file;
+
+	init_lbp_8_1();
+
+	m_init_feat = true;
+	m_init_mean_std = true;
+	m_init_regressor = true;
+
+	if(!fold_normalization())
+		std::cout << "AU estimation: Folding the feature normalization into the regression model failed, using the unfolded model." << std::endl;
+
+	// Quantize the new model with the same setting
+	if(m_quantization != QUANTIZATION_NONE && !set_quantization(m_quantization))
+		std::cout << "AU estimation: Quantizing the regression model failed, using the float model." << std::endl;
+
+	return true;
+}
+
+bool AUIntensityEstimation::save(const std::string & binary_model_filename) const
+{
+	if(!is_initialized())
+		return false;
+
+	// Write to a temporary file first, so concurrent readers never see a partially written model
+	const std::string tmp_filename = binary_model_filename + ".tmp";
+	std::FILE* file = BinaryFile::open(tmp_filename, false);
+	if(!file)
+		return false;
+
+	cv::Mat lbp_table, lbp_num_mapping, AUIds;
+	m_lbp_table.convertTo(lbp_table, CV_32FC1);
+	m_lbp_num_mapping.convertTo(lbp_num_mapping, CV_32FC1);
+	m_AUIds.convertTo(AUIds, CV_32FC1);
+
+	bool okay = true;
+	okay &= BinaryFile::write_one(file, au_model_magic);
+	okay &= BinaryFile::write_one(file, au_model_version);
+	okay &= BinaryFile::write_one(file, uint32_t(m_lbp_num_blocks_x));
+	okay &= BinaryFile::write_one(file, uint32_t(m_lbp_num_blocks_y));
+	okay &= BinaryFile::write_one(file, uint32_t(m_lbp_neighbors));
+	okay &= BinaryFile::write_one(file, uint32_t(m_lbp_radius));
+	okay &= BinaryFile::write_one(file, uint32_t(m_lbp_samples));
+	okay &= BinaryFile::write_one(file, uint32_t(m_lbp_num));
+	okay &= BinaryFile::write_one(file, lbp_table);
+	okay &= BinaryFile::write_one(file, lbp_num_mapping);
+	okay &= BinaryFile::write_one(file, m_mean);
+	okay &= BinaryFile::write_one(file, m_std_inv);
+	okay &= BinaryFile::write_one(file, AUIds);
+	okay &= BinaryFile::write_one(file, m_rho);
+	okay &= BinaryFile::write_one(file, m_wt);
+	okay &= BinaryFile::close(file);
+
+	// Append checksum of everything written so far
+	uint32_t checksum = 0;
+	{
+		MemoryMappedFile written;
+		okay = okay && written.open(tmp_filename);
+		if(okay)
+			checksum = fnv1a(written.data(), written.size());
+	}
+	file = okay ? std::fopen(tmp_filename.c_str(), "ab") : NULL;
+	okay = file != NULL;
+	if(file)
+	{
+		okay &= BinaryFile::write_one(file, checksum);
+		okay &= BinaryFile::close(file);
+	}
+
+	okay = okay && std::rename(tmp_filename.c_str(), binary_model_filename.c_str()) == 0;
+	if(!okay)
+		std::remove(tmp_filename.c_str());
+	return okay;
+}
+
+bool AUIntensityEstimation::init_workspace(Workspace & workspace, const cv::Size & face_size, int max_frames) const
+{
+	if(!is_initialized() || max_frames < 1)
+		return false;
+
+	workspace.gray.create(face_size, CV_8UC1);
+	workspace.codes.create(face_size, CV_8UC1);
+	workspace.features.create(max_frames, m_wt.rows, CV_32FC1);
+	workspace.rho.create(max_frames, m_wt.cols, CV_32FC1);
+	workspace.hist.create(1, m_lbp_num_blocks_x * m_lbp_num_blocks_y * m_lbp_num, CV_16SC1);
+	return true;
 }
 
 bool AUIntensityEstimation::estimate(const cv::Mat & image_registered, const std::vector<cv::Point2f> landmarks_registred, cv::Mat & AUintensities) const
+{
+	Workspace workspace;
+	return estimate(image_registered, landmarks_registred, AUintensities, workspace);
+}
+
+bool AUIntensityEstimation::estimate(const cv::Mat & image_registered, const std::vector<cv::Point2f> & landmarks_registred, cv::Mat & AUintensities, Workspace & workspace) const
 {
 	if(!is_initialized())
 		return false;
 
-	cv::Mat feat, feat_combined;
+	const int num_feat = m_wt.rows;
+	if(m_mean.rows != num_feat || m_std_inv.rows != num_feat)
+		return false;
+
+	if(use_quantized_model(image_registered))
+	{
+		profiler::Timer timer("au_quantized");
+		AUintensities.create(1, m_wt.cols, CV_32FC1);
+		return estimate_quantized(image_registered, landmarks_registred, workspace, AUintensities.ptr<float>(0));
+	}
+
+	if(workspace.features.rows < 1 || workspace.features.cols != num_feat || workspace.features.type() != CV_32FC1)
+		workspace.features.create(1, num_feat, CV_32FC1);
+	float* features = workspace.features.ptr<float>(0);
 
-	if(!extract_features(image_registered, feat))
+	profiler::Timer feature_timer("au_features");
+	if(!extract_combined_features(image_registered, landmarks_registred, workspace, features))
 		return false;
 
-	if(!combine_and_normalize(landmarks_registred, feat, feat_combined))
+	// The folded model includes the normalization
+	if(!use_folded_model())
+		normalize(features);
+	feature_timer.stop();
+
+	profiler::Timer regression_timer("au_regression");
+	AUintensities.create(1, m_wt.cols, CV_32FC1);
+	regression(features, AUintensities.ptr<float>(0));
+
+	return true;
+}
+
+bool AUIntensityEstimation::estimate_batch(const std::vector<cv::Mat> & images_registered, const std::vector<std::vector<cv::Point2f>> & landmarks_registered, cv::Mat & AUintensities) const
+{
+	Workspace workspace;
+	return estimate_batch(images_registered, landmarks_registered, AUintensities, workspace);
+}
+
+bool AUIntensityEstimation::estimate_batch(const std::vector<cv::Mat> & images_registered, const std::vector<std::vector<cv::Point2f>> & landmarks_registered, cv::Mat & AUintensities, Workspace & workspace) const
+{
+	if(!is_initialized() || images_registered.size() != landmarks_registered.size())
 		return false;
 
-	if(!regression(feat_combined, AUintensities))
+	const int num_frames = static_cast<int>(images_registered.size());
+	const int num_feat = m_wt.rows;
+	if(m_mean.rows != num_feat || m_std_inv.rows != num_feat)
 		return false;
 
+	if(num_frames == 0)
+	{
+		AUintensities = cv::Mat(0, m_wt.cols, CV_32FC1);
+		return true;
+	}
+
+	// The quantized model estimates the frames one by one (if it can be used for all of them)
+	bool quantized = true;
+	for(int i = 0; i < num_frames && quantized; i++)
+		quantized = use_quantized_model(images_registered[i]);
+	if(quantized)
+	{
+		AUintensities.create(num_frames, m_wt.cols, CV_32FC1);
+		for(int i = 0; i < num_frames; i++)
+		{
+			profiler::Timer timer("au_quantized");
+			if(!estimate_quantized(images_registered[i], landmarks_registered[i], workspace, AUintensities.ptr<float>(i)))
+				return false;
+		}
+		return true;
+	}
+
+	// Combined features (landmarks and lbp features) of all frames, one row per frame
+	if(workspace.features.rows < num_frames || workspace.features.cols != num_feat || workspace.features.type() != CV_32FC1)
+		workspace.features.create(num_frames, num_feat, CV_32FC1);
+	cv::Mat features = workspace.features.rowRange(0, num_frames);
+	const bool folded = use_folded_model();
+	for(int i = 0; i < num_frames; i++)
+	{
+		profiler::Timer timer("au_features");
+		if(!extract_combined_features(images_registered[i], landmarks_registered[i], workspace, features.ptr<float>(i)))
+			return false;
+
+		// The folded model includes the normalization
+		if(!folded)
+			normalize(features.ptr<float>(i));
+	}
+
+	// Regression offset of every frame
+	profiler::Timer regression_timer("au_regression");
+	const cv::Mat & rho = folded ? m_rho_folded : m_rho;
+	if(workspace.rho.rows < num_frames || workspace.rho.cols != rho.cols || workspace.rho.type() != CV_32FC1)
+		workspace.rho.create(num_frames, rho.cols, CV_32FC1);
+	cv::Mat rho_frames = workspace.rho.rowRange(0, num_frames);
+	for(int i = 0; i < num_frames; i++)
+		rho.copyTo(rho_frames.row(i));
+
+	// Regression of all frames in one (cache blocked) matrix multiplication, same as regression() for each row
+	cv::gemm(features, folded ? m_wt_folded : m_wt, 1.0, rho_frames, -1.0, AUintensities);
+
 	return true;
 }
 
@@ -246,29 +571,34 @@ bool AUIntensityEstimation::load_feature_model(const std::string & filename)
 	if (pFile==NULL)
 		return false;
 
-	fscanf(pFile, "%i %i %i %i", &m_lbp_num_blocks_x, &m_lbp_num_blocks_y, &m_lbp_neighbors, &m_lbp_radius);
+	bool okay = fscanf(pFile, "%i %i %i %i", &m_lbp_num_blocks_x, &m_lbp_num_blocks_y, &m_lbp_neighbors, &m_lbp_radius) == 4;
 
-	fscanf(pFile, "%i %i", &m_lbp_samples, &m_lbp_num);
+	okay = okay && fscanf(pFile, "%i %i", &m_lbp_samples, &m_lbp_num) == 2;
 
 	m_lbp_table = cv::Mat(1, 256, CV_8UC1);
 	m_lbp_num_mapping = cv::Mat(1, 256, CV_8UC1);
 
-	for(int i = 0; i < 256; i++)
+	for(int i = 0; i < 256 && okay; i++)
 	{
 		int v;
-		fscanf(pFile, "%i", &v);
+		okay = fscanf(pFile, "%i", &v) == 1;
 		m_lbp_table.at<uchar>(i) = static_cast<uchar>(v);
 	}
 
-	for(int i = 0; i < 256; i++)
+	for(int i = 0; i < 256 && okay; i++)
 	{
 		int v;
-		fscanf(pFile, "%i", &v);
+		okay = fscanf(pFile, "%i", &v) == 1;
 		m_lbp_num_mapping.at<uchar>(i) = static_cast<uchar>(v);
 	}
 
 	fclose(pFile);
 
+	if(!okay || m_lbp_num_blocks_x == 0 || m_lbp_num_blocks_y == 0)
+		return false;
+
+	init_lbp_8_1();
+
 	m_init_feat = true;
 	return true;}
 
@@ -281,30 +611,35 @@ bool AUIntensityEstimation::load_mean_std(const std::string & filename)
 	if (pFile==NULL)
 		return false;
 
-	int size_mean, size_std;
-	fscanf(pFile, "%i", &size_mean);
+	int size_mean = 0, size_std = 0;
+	bool okay = fscanf(pFile, "%i", &size_mean) == 1 && size_mean > 0;
 
-	m_mean = cv::Mat(size_mean, 1, CV_32FC1);
+	if(okay)
+		m_mean = cv::Mat(size_mean, 1, CV_32FC1);
 
-	float* p_mean = m_mean.ptr<float>(0);
-	for(int i = 0; i < size_mean; i++)
+	float* p_mean = okay ? m_mean.ptr<float>(0) : NULL;
+	for(int i = 0; i < size_mean && okay; i++)
 	{
-		fscanf(pFile, "%f", p_mean++);
+		okay = fscanf(pFile, "%f", p_mean++) == 1;
 	}
 
-	fscanf(pFile, "%i", &size_std);
-	m_std_inv = cv::Mat(size_std, 1, CV_32FC1);
+	okay = okay && fscanf(pFile, "%i", &size_std) == 1 && size_std == size_mean;
+	if(okay)
+		m_std_inv = cv::Mat(size_std, 1, CV_32FC1);
 
-	float* p_std_inv = m_std_inv.ptr<float>(0);
+	float* p_std_inv = okay ? m_std_inv.ptr<float>(0) : NULL;
 	float v;
-	for(int i = 0; i < size_mean; i++)
+	for(int i = 0; i < size_mean && okay; i++)
 	{
-		fscanf(pFile, "%f", &v);
+		okay = fscanf(pFile, "%f", &v) == 1;
 		p_std_inv[i] = 1.0 / v;
 	}
 
 	fclose(pFile);
 
+	if(!okay)
+		return false;
+
 	m_init_mean_std = true;
 	return true;
 }
@@ -318,34 +653,40 @@ bool AUIntensityEstimation::load_regression_model(const std::string & filename)
 	if (pFile==NULL)
 		return false;
 
-	int num_AUs;
-	fscanf(pFile, "%i", &num_AUs);
+	int num_AUs = 0;
+	bool okay = fscanf(pFile, "%i", &num_AUs) == 1 && num_AUs > 0;
 
-	m_AUIds = cv::Mat(1, num_AUs, CV_32SC1);
-	int* p_id = m_AUIds.ptr<int>(0);
-	for(int au = 0; au < num_AUs; au++)
-		fscanf(pFile, "%i", p_id++);
+	if(okay)
+		m_AUIds = cv::Mat(1, num_AUs, CV_32SC1);
+	int* p_id = okay ? m_AUIds.ptr<int>(0) : NULL;
+	for(int au = 0; au < num_AUs && okay; au++)
+		okay = fscanf(pFile, "%i", p_id++) == 1;
 	
-	m_rho = cv::Mat(1, num_AUs, CV_32FC1);
-	float* p_r = m_rho.ptr<float>(0);
-	for(int au = 0; au < num_AUs; au++)
-		fscanf(pFile, "%f", p_r++);
+	if(okay)
+		m_rho = cv::Mat(1, num_AUs, CV_32FC1);
+	float* p_r = okay ? m_rho.ptr<float>(0) : NULL;
+	for(int au = 0; au < num_AUs && okay; au++)
+		okay = fscanf(pFile, "%f", p_r++) == 1;
 
-	int num_feat;
-	fscanf(pFile, "%i", &num_feat);
+	int num_feat = 0;
+	okay = okay && fscanf(pFile, "%i", &num_feat) == 1 && num_feat > 0;
 
-	m_wt = cv::Mat(num_AUs, num_feat, CV_32FC1);
+	if(okay)
+		m_wt = cv::Mat(num_AUs, num_feat, CV_32FC1);
 
-	float* p_wt = m_wt.ptr<float>(0);
-	for(int i = 0; i < num_feat * num_AUs; i++)
+	float* p_wt = okay ? m_wt.ptr<float>(0) : NULL;
+	for(int i = 0; i < num_feat * num_AUs && okay; i++)
 	{
-		fscanf(pFile, "%f", p_wt++);
+		okay = fscanf(pFile, "%f", p_wt++) == 1;
 	}
 
-	m_wt = m_wt.t();
-
 	fclose(pFile);
 
+	if(!okay)
+		return false;
+
+	m_wt = m_wt.t();
+
 	m_init_regressor = true;
 	return true;
 }
@@ -357,6 +698,15 @@ bool AUIntensityEstimation::extract_features(const cv::Mat & image_registered, c
 	if(!m_init_feat)
 		return false;
 
+	// Fast path for the 8 neighbors / radius 1 operator, which gives exactly the same features as the generic code below
+	// (unless the per block border is disabled, see set_lbp_per_block_border())
+	if(use_lbp_8_1(image_registered))
+	{
+		Workspace workspace;
+		features.create(m_lbp_num_blocks_x * m_lbp_num_blocks_y * m_lbp_num, 1, CV_32FC1);
+		return lbp_features_8_1(image_registered, workspace, features.ptr<float>(0));
+	}
+
 	// Release feature data
 	features = cv::Mat(0,0,CV_64FC1);
 
@@ -397,38 +747,216 @@ bool AUIntensityEstimation::extract_features(const cv::Mat & image_registered, c
 	return true;
 }
 
-bool AUIntensityEstimation::combine_and_normalize(const std::vector<cv::Point2f> & landmarks, const cv::Mat & lbp_features, cv::Mat & features_combined) const
+bool AUIntensityEstimation::extract_combined_features(const cv::Mat & image_registered, const std::vector<cv::Point2f> & landmarks, Workspace & workspace, float* features) const
 {
-	if(!m_init_mean_std)
-		return false;
+	// Landmarks first, followed by the lbp features
+	const int num_lbp_feat = m_wt.rows - static_cast<int>(landmarks.size()) * 2;
+	for(size_t i = 0; i < landmarks.size(); i++) {
+		*features++ = landmarks[i].x;
+		*features++ = landmarks[i].y;
+	}
 
-	// Allocate memory for landmarks
-	features_combined = cv::Mat(landmarks.size() * 2, 1, CV_32FC1);
-	
-	// Append landmarks
-	float* p = features_combined.ptr<float>(0);
-	for(int i = 0, j = 0; i < landmarks.size(); i++, j+=2) {
-		p[j] = landmarks[i].x;
-		p[j+1] = landmarks[i].y;
+	// The fast path writes the lbp features directly into the combined features
+	if(use_lbp_8_1(image_registered))
+	{
+		if(static_cast<int>(m_lbp_num_blocks_x * m_lbp_num_blocks_y * m_lbp_num) != num_lbp_feat)
+			return false;
+		return lbp_features_8_1(image_registered, workspace, features);
 	}
 
-	// Append features
-	features_combined.push_back(lbp_features);
+	cv::Mat lbp_features;
+	if(!extract_features(image_registered, lbp_features) || lbp_features.rows != num_lbp_feat)
+		return false;
 
-	features_combined -= m_mean;
-	features_combined = features_combined.mul(m_std_inv);
+	const float* p_lbp = lbp_features.ptr<float>(0);
+	std::copy(p_lbp, p_lbp + num_lbp_feat, features);
 
-	// Done!
 	return true;
 }
 
-bool AUIntensityEstimation::regression(const cv::Mat & feature, cv::Mat & prob) const
+void AUIntensityEstimation::normalize(float* features) const
 {
-	if(!m_init_regressor)
+	// (features - mean) .* std_inv in place
+	const float* p_mean = m_mean.ptr<float>(0);
+	const float* p_std_inv = m_std_inv.ptr<float>(0);
+	for(int j = 0; j < m_mean.rows; j++)
+		features[j] = (features[j] - p_mean[j]) * p_std_inv[j];
+}
+
+bool AUIntensityEstimation::fold_normalization()
+{
+	m_wt_folded.release();
+	m_rho_folded.release();
+
+	const int num_feat = m_wt.rows;
+	if(m_mean.rows != num_feat || m_std_inv.rows != num_feat)
 		return false;
 
-	prob = feature.t() * m_wt - m_rho;
+	// ((f - mean) .* std_inv)' * wt - rho = f' * (diag(std_inv) * wt) - (rho + (mean .* std_inv)' * wt), computed in double
+	cv::Mat wt, mean, std_inv, rho;
+	m_wt.convertTo(wt, CV_64FC1);
+	m_mean.convertTo(mean, CV_64FC1);
+	m_std_inv.convertTo(std_inv, CV_64FC1);
+	m_rho.convertTo(rho, CV_64FC1);
+
+	cv::Mat wt_folded = wt.mul(cv::repeat(std_inv, 1, wt.cols));
+	cv::Mat rho_folded = rho + mean.mul(std_inv).t() * wt;
+	wt_folded.convertTo(m_wt_folded, CV_32FC1);
+	rho_folded.convertTo(m_rho_folded, CV_32FC1);
+
+	// Weights that do not fit into float (e.g. huge std_inv) would change the results, keep the unfolded model then.
+	// The equivalence of both models is checked by "ICCV17Benchmark --check".
+	if(!cv::checkRange(m_wt_folded) || !cv::checkRange(m_rho_folded))
+	{
+		m_wt_folded.release();
+		m_rho_folded.release();
+		return false;
+	}
+
+	return true;
+}
+
+void AUIntensityEstimation::regression(const float* features, float* prob) const
+{
+	// features' * wt - rho without temporary matrices. Like cv::gemm(), the products are summed up in double precision.
+	// The folded model expects features that are not normalized (see fold_normalization()).
+	const bool folded = use_folded_model();
+	const cv::Mat & wt = folded ? m_wt_folded : m_wt;
+	const float* p_rho = (folded ? m_rho_folded : m_rho).ptr<float>(0);
+
+	cv::AutoBuffer<double> sum(wt.cols);
+	std::fill(static_cast<double*>(sum), static_cast<double*>(sum) + wt.cols, 0.0);
+	for(int j = 0; j < wt.rows; j++)
+	{
+		const double f = features[j];
+		const float* p_wt = wt.ptr<float>(j);
+		for(int au = 0; au < wt.cols; au++)
+			sum[au] += f * p_wt[au];
+	}
+	for(int au = 0; au < wt.cols; au++)
+		prob[au] = static_cast<float>(sum[au] - p_rho[au]);
 	//prob = cv::max(prob, 0.0);
+}
+
+
+bool AUIntensityEstimation::set_quantization(Quantization quantization)
+{
+	m_quantization = quantization;
+	m_wt_quantized.release();
+	m_wt_scale.release();
+	m_quantized_dot16 = 0;
+	m_quantized_dot8 = 0;
+	if(quantization == QUANTIZATION_NONE)
+		return true;
+
+	// The quantized model needs raw (not normalized) LBP counts
+	const int num_lbp_feat = static_cast<int>(m_lbp_num_blocks_x * m_lbp_num_blocks_y * m_lbp_num);
+	if(!is_initialized() || m_wt_folded.empty() || m_lbp_kernel == LBP_KERNEL_GENERIC || m_wt_folded.rows < num_lbp_feat)
+	{
+		m_quantization = QUANTIZATION_NONE;
+		return false;
+	}
+	const int num_landmark_feat = m_wt_folded.rows - num_lbp_feat;
+
+	// Symmetric quantization of the LBP weights of each AU: w = scale * q with |q| <= max_q
+	const double max_q = quantization == QUANTIZATION_INT8 ? 127.0 : 32767.0;
+	m_wt_quantized.create(m_wt_folded.cols, num_lbp_feat, quantization == QUANTIZATION_INT8 ? CV_8SC1 : CV_16SC1);
+	m_wt_scale.create(1, m_wt_folded.cols, CV_64FC1);
+	for(int au = 0; au < m_wt_folded.cols; au++)
+	{
+		double max_abs = 0.0;
+		for(int j = 0; j < num_lbp_feat; j++)
+			max_abs = std::max(max_abs, std::abs(static_cast<double>(m_wt_folded.at<float>(num_landmark_feat + j, au))));
+		const double scale = max_abs > 0.0 ? max_abs / max_q : 1.0;
+		m_wt_scale.at<double>(au) = scale;
+
+		for(int j = 0; j < num_lbp_feat; j++)
+		{
+			const double q = m_wt_folded.at<float>(num_landmark_feat + j, au) / scale;
+			if(quantization == QUANTIZATION_INT8)
+				m_wt_quantized.at<schar>(au, j) = cv::saturate_cast<schar>(q);
+			else
+				m_wt_quantized.at<short>(au, j) = cv::saturate_cast<short>(q);
+		}
+	}
+
+	// Choose the vectorized dot product for this CPU (see init_lbp_8_1())
+#ifdef CV_CPU_AVX2
+	if(cv::checkHardwareSupport(CV_CPU_AVX2))
+	{
+		m_quantized_dot16 = quantized_dot16_avx2;
+		m_quantized_dot8 = quantized_dot8_avx2;
+	}
+	else
+#endif
+	if(cv::checkHardwareSupport(CV_CPU_SSE4_1))
+	{
+		m_quantized_dot16 = quantized_dot16_sse41;
+		m_quantized_dot8 = quantized_dot8_sse41;
+	}
+
+	return true;
+}
+
+bool AUIntensityEstimation::use_quantized_model(const cv::Mat & image_registered) const
+{
+	if(m_quantization == QUANTIZATION_NONE || m_wt_quantized.empty() || !use_lbp_8_1(image_registered))
+		return false;
+
+	// Every pixel is counted in one histogram bin at most, so the 32 bit sums cannot overflow if the number of pixels
+	// times the largest weight fits into int32. The counts of a block must fit into int16.
+	const double max_q = m_quantization == QUANTIZATION_INT8 ? 127.0 : 32767.0;
+	const double block_size = static_cast<double>(image_registered.cols / m_lbp_num_blocks_x) * (image_registered.rows / m_lbp_num_blocks_y);
+	return static_cast<double>(image_registered.cols) * image_registered.rows * max_q <= 2147483647.0 && block_size <= 32767.0;
+}
+
+bool AUIntensityEstimation::estimate_quantized(const cv::Mat & image_registered, const std::vector<cv::Point2f> & landmarks, Workspace & workspace, float* prob) const
+{
+	const int num_lbp_feat = m_wt_quantized.cols;
+	const int num_landmark_feat = m_wt_folded.rows - num_lbp_feat;
+	if(static_cast<int>(landmarks.size()) * 2 != num_landmark_feat)
+		return false;
+
+	if(!lbp_codes_8_1(image_registered, workspace))
+		return false;
+	if(workspace.hist.cols != num_lbp_feat || workspace.hist.type() != CV_16SC1)
+		workspace.hist.create(1, num_lbp_feat, CV_16SC1);
+	int16_t* hist = workspace.hist.ptr<int16_t>(0);
+	lbp_histograms_8_1(workspace.codes, hist);
+
+	// Landmark features in floating point, like regression() with the folded model
+	cv::AutoBuffer<double> sum(m_wt_folded.cols);
+	std::fill(static_cast<double*>(sum), static_cast<double*>(sum) + m_wt_folded.cols, 0.0);
+	for(int j = 0; j < num_landmark_feat; j++)
+	{
+		const double f = (j % 2 == 0) ? landmarks[j / 2].x : landmarks[j / 2].y;
+		const float* p_wt = m_wt_folded.ptr<float>(j);
+		for(int au = 0; au < m_wt_folded.cols; au++)
+			sum[au] += f * p_wt[au];
+	}
+
+	// LBP features in integer arithmetic
+	const float* p_rho = m_rho_folded.ptr<float>(0);
+	for(int au = 0; au < m_wt_folded.cols; au++)
+	{
+		int32_t dot = 0;
+		int k = 0;
+		if(m_quantization == QUANTIZATION_INT8)
+		{
+			const int8_t* q = m_wt_quantized.ptr<int8_t>(au);
+			k = m_quantized_dot8 ? m_quantized_dot8(hist, q, num_lbp_feat, dot) : 0;
+			for(; k < num_lbp_feat; k++)
+				dot += hist[k] * q[k];
+		}
+		else
+		{
+			const int16_t* q = m_wt_quantized.ptr<int16_t>(au);
+			k = m_quantized_dot16 ? m_quantized_dot16(hist, q, num_lbp_feat, dot) : 0;
+			for(; k < num_lbp_feat; k++)
+				dot += hist[k] * q[k];
+		}
+		prob[au] = static_cast<float>(sum[au] + m_wt_scale.at<double>(au) * dot - p_rho[au]);
+	}
 
 	return true;
 }
@@ -544,6 +1072,250 @@ bool AUIntensityEstimation::lbp(const cv::Mat& image, cv::Mat& feature) const
 	return true;
 }
 
+void AUIntensityEstimation::init_lbp_8_1()
+{
+	m_lbp_kernel = LBP_KERNEL_GENERIC;
+	m_lbp_row_kernel = 0;
+	if(m_lbp_neighbors != 8 || m_lbp_radius != 1 || m_lbp_num > 256)
+		return;
+
+	// Sample points, weights, and the interpolation decision are computed with exactly the same
+	// expressions as in lbp(), so the specialized kernel takes the same samples as the generic one.
+	double neighbors = static_cast<double>(m_lbp_neighbors);
+	double radius = static_cast<double>(m_lbp_radius);
+	double a = 2.0 * PI / neighbors;
+
+	cv::Mat spoints(m_lbp_neighbors, 2, CV_64FC1);
+	for(unsigned int i = 0; i < m_lbp_neighbors; i++)
+	{
+		spoints.at<double>(i, 0) = -radius * sin(i * a);
+		spoints.at<double>(i, 1) = radius * cos(i * a);
+	}
+
+	double miny, maxy, minx, maxx;
+	cv::minMaxLoc(spoints.col(0), &miny, &maxy);
+	cv::minMaxLoc(spoints.col(1), &minx, &maxx);
+
+	int bsizey = static_cast<int>(std::ceil(std::max(maxy,0.0)) - std::floor(std::min(miny,0.0)) + 1);
+	int bsizex = static_cast<int>(std::ceil(std::max(maxx,0.0)) - std::floor(std::min(minx,0.0)) + 1);
+	int origy = -static_cast<int>(floor(std::min(miny,0.0)));
+	int origx = -static_cast<int>(floor(std::min(minx,0.0)));
+	if(bsizex != 3 || bsizey != 3 || origx != 1 || origy != 1)
+		return;
+
+	// Number of interpolated neighbors with even and odd index
+	int num_interpolated[2] = { 0, 0 };
+	for(int i = 0; i < 8; i++)
+	{
+		double y = spoints.at<double>(i,0)+origy;
+		double x = spoints.at<double>(i,1)+origx;
+
+		int fy = static_cast<int>(floor(y)), cy = static_cast<int>(ceil(y)), ry = cvRound(y);
+		int fx = static_cast<int>(floor(x)), cx = static_cast<int>(ceil(x)), rx = cvRound(x);
+
+		if((abs(x - rx) < 1e-6) && (abs(y - ry) < 1e-6))
+		{
+			for(int k = 0; k < 4; k++)
+			{
+				m_lbp_offset_x[i][k] = rx - origx;
+				m_lbp_offset_y[i][k] = ry - origy;
+				m_lbp_weights[i][k] = 0.0;
+			}
+		}
+		else
+		{
+			double ty = y - fy;
+			double tx = x - fx;
+
+			m_lbp_weights[i][0] = roundn((1 - tx) * (1 - ty),-6);
+			m_lbp_weights[i][1] = roundn(tx * (1 - ty),-6);
+			m_lbp_weights[i][2] = roundn((1 - tx) * ty,-6) ;
+			m_lbp_weights[i][3] = roundn(1 - m_lbp_weights[i][0] - m_lbp_weights[i][1] - m_lbp_weights[i][2], -6);
+
+			const int sx[4] = { fx, cx, fx, cx };
+			const int sy[4] = { fy, fy, cy, cy };
+			for(int k = 0; k < 4; k++)
+			{
+				m_lbp_offset_x[i][k] = sx[k] - origx;
+				m_lbp_offset_y[i][k] = sy[k] - origy;
+			}
+			num_interpolated[i % 2]++;
+		}
+	}
+
+	// The kernel is specialized for the axis neighbors being pixel centers and the diagonal neighbors being either all
+	// interpolated (the usual case) or all rounded to pixel centers.
+	if(num_interpolated[0] == 0 && num_interpolated[1] == 4)
+		m_lbp_kernel = LBP_KERNEL_8_1;
+	else if(num_interpolated[0] == 0 && num_interpolated[1] == 0)
+		m_lbp_kernel = LBP_KERNEL_8_1_NEAREST;
+
+	// Choose the vectorized row kernel for this CPU. cv::checkHardwareSupport() also returns false if
+	// optimizations are disabled with cv::setUseOptimized(false), which leaves the scalar code.
+	m_lbp_row_kernel = 0;
+#ifdef CV_CPU_AVX2
+	if(cv::checkHardwareSupport(CV_CPU_AVX2))
+		m_lbp_row_kernel = lbp_8_1_row_avx2;
+	else
+#endif
+	if(cv::checkHardwareSupport(CV_CPU_SSE4_1))
+		m_lbp_row_kernel = lbp_8_1_row_sse41;
+}
+
+bool AUIntensityEstimation::use_lbp_8_1(const cv::Mat& image) const
+{
+	return m_lbp_kernel != LBP_KERNEL_GENERIC && image.depth() == CV_8U && (image.channels() == 3 || image.channels() == 1)
+		&& image.cols >= 3 * static_cast<int>(m_lbp_num_blocks_x) && image.rows >= 3 * static_cast<int>(m_lbp_num_blocks_y);
+}
+
+bool AUIntensityEstimation::lbp_features_8_1(const cv::Mat& image, Workspace& workspace, float* features) const
+{
+	if(!lbp_codes_8_1(image, workspace))
+		return false;
+
+	lbp_histograms_8_1(workspace.codes, features);
+	return true;
+}
+
+bool AUIntensityEstimation::lbp_codes_8_1(const cv::Mat& image, Workspace& workspace) const
+{
+	cv::Mat im_gray = image;
+	if(image.channels() == 3)
+	{
+		cv::cvtColor(image, workspace.gray, CV_BGR2GRAY);
+		im_gray = workspace.gray;
+	}
+
+	if(im_gray.cols % m_lbp_num_blocks_x != 0 || im_gray.rows % m_lbp_num_blocks_y != 0) {
+		std::cout << "Feature extraction error: Image size must be a multiple of feature_param lbp_num_blocks" << std::endl;
+		return false;
+	}
+
+	// LBP codes of the whole face at once. The codes of the pixels inside a block are the same as if
+	// computed on the block only, because the neighbors of these pixels are inside the block, too.
+	if(m_lbp_kernel == LBP_KERNEL_8_1)
+		lbp_code_image_8_1<true>(im_gray, workspace.codes);
+	else
+		lbp_code_image_8_1<false>(im_gray, workspace.codes);
+
+	return true;
+}
+
+template<typename T>
+void AUIntensityEstimation::lbp_histograms_8_1(const cv::Mat& codes, T* hist) const
+{
+	const int step_x = codes.cols / static_cast<int>(m_lbp_num_blocks_x);
+	const int step_y = codes.rows / static_cast<int>(m_lbp_num_blocks_y);
+
+	// All block histograms in one sweep over the code image. By default the pixels on the border of each block are
+	// skipped like in lbp(), otherwise all pixels with a code (all but the image border) are counted.
+	const int border = m_lbp_per_block_border ? 1 : 0;
+	std::fill(hist, hist + m_lbp_num_blocks_x * m_lbp_num_blocks_y * m_lbp_num, T(0));
+	for(int r = 1; r < codes.rows - 1; r++)
+	{
+		const int y = r / step_y;
+		const int block_r = r - y * step_y;
+		if(block_r < border || block_r >= step_y - border)
+			continue;
+
+		const uchar* code_row = codes.ptr<uchar>(r);
+		for(int x = 0; x < static_cast<int>(m_lbp_num_blocks_x); x++)
+		{
+			// Same block order as the generic code in extract_features()
+			T* block_hist = hist + (x * m_lbp_num_blocks_y + y) * m_lbp_num;
+			const int c_begin = std::max(x * step_x + border, 1);
+			const int c_end = std::min((x + 1) * step_x - border, codes.cols - 1);
+			for(int c = c_begin; c < c_end; c++)
+			{
+				// Mapped codes outside the histogram range are ignored (as in cv::calcHist())
+				const unsigned int code = code_row[c];
+				if(code < m_lbp_num)
+					++block_hist[code];
+			}
+		}
+	}
+}
+
+namespace {
+
+// Comparison of neighbor and center pixel (c) as in lbp(), where all pixel values are divided by 256.
+template<bool interpolate>
+inline unsigned int lbp_compare(const uchar* p, const ptrdiff_t* offsets, const double* weights, int c);
+
+template<>
+inline unsigned int lbp_compare<false>(const uchar* p, const ptrdiff_t* offsets, const double* weights, int c)
+{
+	return p[offsets[0]] >= c;
+}
+
+template<>
+inline unsigned int lbp_compare<true>(const uchar* p, const ptrdiff_t* offsets, const double* weights, int c)
+{
+	// Same operations in the same order as the cv::Mat expression in lbp() (one addWeighted() and two scaleAdd() calls).
+	// Must not be contracted to fused multiply-adds.
+	double n = (p[offsets[0]] / 256.0) * weights[0] + (p[offsets[1]] / 256.0) * weights[1];
+	n = (p[offsets[2]] / 256.0) * weights[2] + n;
+	n = (p[offsets[3]] / 256.0) * weights[3] + n;
+
+	// roundn(n, -4) is r / 10000. Comparing r / 10000 >= c / 256 in double precision gives the same result as the
+	// exact integer comparison, because both fractions differ by at least 1 / 2560000 if they are not equal.
+	const int r = cvRound(10000.0 * n);
+	return 16 * r >= 625 * c;
+}
+
+template<bool interpolate_diagonals>
+inline uchar lbp_code_8_1(const uchar* p, const LbpPattern8& pattern)
+{
+	const int c = *p;
+	return static_cast<uchar>(
+		lbp_compare<false>(p, pattern.offsets[0], pattern.weights[0], c) |
+		lbp_compare<interpolate_diagonals>(p, pattern.offsets[1], pattern.weights[1], c) << 1 |
+		lbp_compare<false>(p, pattern.offsets[2], pattern.weights[2], c) << 2 |
+		lbp_compare<interpolate_diagonals>(p, pattern.offsets[3], pattern.weights[3], c) << 3 |
+		lbp_compare<false>(p, pattern.offsets[4], pattern.weights[4], c) << 4 |
+		lbp_compare<interpolate_diagonals>(p, pattern.offsets[5], pattern.weights[5], c) << 5 |
+		lbp_compare<false>(p, pattern.offsets[6], pattern.weights[6], c) << 6 |
+		lbp_compare<interpolate_diagonals>(p, pattern.offsets[7], pattern.weights[7], c) << 7);
+}
+
+}
+
+template<bool interpolate_diagonals>
+void AUIntensityEstimation::lbp_code_image_8_1(const cv::Mat& image, cv::Mat& codes) const
+{
+	CV_Assert(image.type() == CV_8UC1 && image.cols >= 3 && image.rows >= 3);
+
+	// Sample offsets in bytes relative to the center pixel
+	LbpPattern8 pattern;
+	for(int i = 0; i < 8; i++)
+	{
+		for(int k = 0; k < 4; k++)
+		{
+			pattern.offsets[i][k] = m_lbp_offset_y[i][k] * static_cast<ptrdiff_t>(image.step) + m_lbp_offset_x[i][k];
+			pattern.weights[i][k] = m_lbp_weights[i][k];
+		}
+	}
+
+	const uchar* table = m_lbp_table.ptr<uchar>(0);
+
+	// Mapped LBP code of every pixel not on the image border (the border of codes is not set), row by row
+	codes.create(image.size(), CV_8UC1);
+	const int n = image.cols - 2;
+	for(int j = 1; j < image.rows - 1; j++)
+	{
+		const uchar* p = image.ptr<uchar>(j) + 1;
+		uchar* code = codes.ptr<uchar>(j) + 1;
+
+		// SIMD kernel (if supported by the CPU), the scalar code does the rest
+		int k = m_lbp_row_kernel ? m_lbp_row_kernel(p, n, pattern, interpolate_diagonals, code) : 0;
+		for(; k < n; k++)
+			code[k] = lbp_code_8_1<interpolate_diagonals>(p + k, pattern);
+
+		for(k = 0; k < n; k++)
+			code[k] = table[code[k]];
+	}
+}
+
 cv::Mat AUIntensityEstimation::roundn(const cv::Mat& x, const int n) const
 {
 	// Accept only double matrices
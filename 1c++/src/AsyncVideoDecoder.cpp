@@ -0,0 +1,85 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "AsyncVideoDecoder.hpp"
+#include <dlib/opencv.h>
+#include <dlib/image_transforms.h>
+#include <chrono>
+
+namespace
+{
+	// Wait strategy while the buffer is full (producer) or empty (consumer): spin briefly, then sleep to free the core
+	inline void backoff(int & iteration)
+	{
+		if (++iteration < 64)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+AsyncVideoDecoder::AsyncVideoDecoder(const std::string & filename, size_t buffer_size)
+	: m_vid(filename), m_opened(false), m_buffer(buffer_size), m_finished(false), m_stop(false)
+{
+	m_opened = m_vid.isOpened();
+	if (m_opened)
+		m_thread = std::thread(&AsyncVideoDecoder::decode, this);
+	else
+		m_finished = true;
+}
+
+AsyncVideoDecoder::~AsyncVideoDecoder()
+{
+	m_stop = true;
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool AsyncVideoDecoder::read(image_type & img)
+{
+	int iteration = 0;
+	for (;;)
+	{
+		if (m_buffer.try_pop(img))
+			return true;
+		// The producer may have pushed its last frames right before finishing, so check the buffer once more
+		if (m_finished.load(std::memory_order_acquire))
+		{
+			if (m_buffer.try_pop(img))
+				return true;
+			// An error of the decoding thread fails the caller like in the synchronous case, instead of ending the video early
+			if (m_error)
+				std::rethrow_exception(m_error);
+			return false;
+		}
+		backoff(iteration);
+	}
+}
+
+void AsyncVideoDecoder::decode()
+{
+	cv::Mat cvBGRImg;
+	image_type img;
+	try
+	{
+		while (!m_stop && m_vid.read(cvBGRImg))
+		{
+			// Convert on the producer side, so the consumer gets frames ready for the detector
+			dlib::assign_image(img, dlib::cv_image<dlib::bgr_pixel>(cvBGRImg));
+
+			int iteration = 0;
+			while (!m_buffer.try_push(img))
+			{
+				if (m_stop)
+					break;
+				backoff(iteration);
+			}
+		}
+	}
+	catch (...)
+	{
+		// Passed to the consumer by read() after the decoded frames (m_finished publishes m_error)
+		m_error = std::current_exception();
+	}
+	m_finished.store(true, std::memory_order_release);
+}
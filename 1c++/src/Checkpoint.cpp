@@ -0,0 +1,152 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "Checkpoint.hpp"
+#include <sstream>
+#include <iomanip>
+#include <stdint.h>
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	// 64 bit FNV-1a hash
+	const uint64_t fnv_offset = 14695981039346656037ull;
+	const uint64_t fnv_prime = 1099511628211ull;
+
+	uint64_t fnv1a(const void * data, size_t size, uint64_t hash = fnv_offset)
+	{
+		const unsigned char * bytes = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= fnv_prime;
+		}
+		return hash;
+	}
+
+	std::string hex(uint64_t value)
+	{
+		std::ostringstream ss;
+		ss << std::hex << std::setw(16) << std::setfill('0') << value;
+		return ss.str();
+	}
+}
+
+Checkpoint::Checkpoint(const std::string & filename, const std::string & models_key, bool reuse)
+	: m_filename(filename), m_models_key(models_key)
+{
+	if (!reuse)
+		return;
+
+	std::ifstream file(filename);
+	std::string line;
+	if (!std::getline(file, line) || line != models_key)
+		return;
+
+	long vid_id;
+	std::string key;
+	while (file >> vid_id >> key)
+		m_previous[vid_id] = key;
+}
+
+bool Checkpoint::is_done(long vid_id, const std::string & key) const
+{
+	auto it = m_previous.find(vid_id);
+	return it != m_previous.end() && it->second == key;
+}
+
+bool Checkpoint::start(const std::vector<std::string> & keys, const std::vector<bool> & reused)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_file.open(m_filename, std::ios::trunc);
+	m_file << m_models_key << "\n";
+	for (size_t vid_id = 0; vid_id < keys.size(); ++vid_id)
+		if (reused.at(vid_id))
+			m_file << vid_id << " " << keys[vid_id] << "\n";
+	m_file.flush();
+	return bool(m_file);
+}
+
+void Checkpoint::set_done(long vid_id, const std::string & key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_file << vid_id << " " << key << "\n";
+	m_file.flush();
+}
+
+std::string Checkpoint::file_key(const std::string & filename)
+{
+	std::error_code ec;
+	const auto size = fs::file_size(filename, ec);
+	if (ec)
+		return "-";
+	const auto time = fs::last_write_time(filename, ec);
+	if (ec)
+		return "-";
+	std::ostringstream ss;
+	ss << size << "-" << time.time_since_epoch().count();
+	return ss.str();
+}
+
+std::string Checkpoint::content_key(const std::string & filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open())
+		return "-";
+
+	uint64_t hash = fnv_offset;
+	std::vector<char> buffer(1 << 16);
+	while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+		hash = fnv1a(buffer.data(), file.gcount(), hash);
+	return hex(hash);
+}
+
+std::string Checkpoint::data_key(const void * data, size_t size)
+{
+	return hex(fnv1a(data, size));
+}
+
+std::vector<std::string> video_input_keys(const std::vector<std::string> & filename_list, const std::vector<std::vector<dlib::rectangle>> * face_dets_list)
+{
+	std::vector<std::string> keys;
+	std::vector<int32_t> boxes;
+	for (size_t vid_id = 0; vid_id < filename_list.size(); ++vid_id)
+	{
+		std::string key = Checkpoint::file_key(filename_list[vid_id]);
+		if (face_dets_list)
+		{
+			boxes.clear();
+			for (const auto & det : face_dets_list->at(vid_id))
+			{
+				boxes.push_back(int32_t(det.left()));
+				boxes.push_back(int32_t(det.top()));
+				boxes.push_back(int32_t(det.right()));
+				boxes.push_back(int32_t(det.bottom()));
+			}
+			key += ":" + Checkpoint::data_key(boxes.data(), boxes.size() * sizeof(int32_t));
+		}
+		keys.push_back(key);
+	}
+	return keys;
+}
+
+bool read_reused_results(const Checkpoint & checkpoint, const std::vector<std::string> & keys, const std::string & store_filename,
+	const std::vector<ResultColumn> & columns, std::vector<ResultVideo> & videos, std::vector<bool> & reused)
+{
+	videos.assign(keys.size(), ResultVideo(columns));
+	reused.assign(keys.size(), false);
+
+	ResultStoreReader reader(store_filename, true);
+	if (!reader.is_open() || reader.num_videos() != long(keys.size()) || !(reader.columns() == columns))
+		return false;
+
+	bool all_reused = reader.is_complete();
+	for (size_t vid_id = 0; vid_id < keys.size(); ++vid_id)
+	{
+		reused[vid_id] = checkpoint.is_done(vid_id, keys[vid_id]) && reader.has_video(vid_id) && reader.read(vid_id, videos[vid_id]);
+		all_reused &= reused[vid_id];
+	}
+	return all_reused;
+}
@@ -0,0 +1,96 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include "ExtractionOptions.hpp"
+
+// Parse the options argv[first_arg], ..., argv[argc - 1] (see help() in main.cpp), prints an error and returns false for unknown options
+bool parseOptions(int argc, char **argv, int first_arg, ExtractionOptions& options)
+{
+	for(int i = first_arg; i < argc; ++i)
+	{
+		std::string arg = std::string(argv[i]);
+		if(arg == "--fused")
+			options.fused = true;
+		else if(arg == "--detector" && i + 1 < argc)
+		{
+			options.detector = std::string(argv[++i]);
+			if(options.detector != "cnn" && options.detector != "hog")
+			{
+				std::cout << "Error: --detector must be cnn or hog" << std::endl;
+				return false;
+			}
+		}
+		else if(arg == "--async-decode")
+			options.async_decode = true;
+		else if(arg == "--track" && i + 1 < argc)
+		{
+			options.keyframe_interval = std::atol(argv[++i]);
+			if(options.keyframe_interval < 1)
+			{
+				std::cout << "Error: --track requires a positive number" << std::endl;
+				return false;
+			}
+		}
+		else if(arg == "--track-confidence" && i + 1 < argc)
+			options.min_tracking_confidence = std::atof(argv[++i]);
+		else if(arg == "--roi" && i + 1 < argc)
+		{
+			options.roi_scale = std::atof(argv[++i]);
+			if(options.roi_scale < 1.0)
+			{
+				std::cout << "Error: --roi requires a scale factor of at least 1" << std::endl;
+				return false;
+			}
+		}
+		else if(arg == "--affine-svd")
+			options.affine_svd = true;
+		else if(arg == "--gray-warp")
+			options.gray_warp = true;
+		else if(arg == "--au-unfolded")
+			options.au_unfolded = true;
+		else if(arg == "--au-quantized" && i + 1 < argc)
+		{
+			options.au_quantization = std::string(argv[++i]);
+			if(options.au_quantization != "int16" && options.au_quantization != "int8")
+			{
+				std::cout << "Error: --au-quantized must be int16 or int8" << std::endl;
+				return false;
+			}
+		}
+		else if(arg == "--recompute")
+			options.recompute = true;
+		else if(arg == "--no-csv")
+			options.export_csv = false;
+		else if(arg == "--au-calibrate")
+			options.au_calibrate = true;
+		else if(arg == "--profile" && i + 1 < argc)
+			options.profile_file = std::string(argv[++i]);
+		else if(arg == "--trace" && i + 1 < argc)
+			options.trace_file = std::string(argv[++i]);
+		else if(arg == "--jobs" && i + 1 < argc)
+		{
+			options.jobs = std::atol(argv[++i]);
+			if(options.jobs < 1)
+			{
+				std::cout << "Error: --jobs requires a positive number" << std::endl;
+				return false;
+			}
+		}
+		else
+		{
+			std::cout << "Error: Unknown option " << arg << std::endl;
+			return false;
+		}
+	}
+
+	// The quantized weights are derived from the folded model, so the unfolded normalization would be ignored
+	if(options.au_unfolded && options.au_quantization != "none")
+	{
+		std::cout << "Error: --au-unfolded cannot be combined with --au-quantized" << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -60,6 +60,61 @@ cv::Mat estimateAffineTransform(const std::vector<cv::Point2f> & src, const std:
     return M;
 }
 
+/* Same least squares problem as estimateAffineTransform(), but solved in closed form.
+ * The system matrix is block diagonal with two identical blocks S = [x y 1], so both rows of the transform
+ * are solutions of the 3x3 normal equations S'S c = S'u resp. S'S c = S'v. After centering the source points,
+ * S'S becomes block diagonal too: the offset is the mean of the destination points (dst_center) and the
+ * linear part is the solution of a 2x2 system.
+ * Returns an empty matrix if the source points are degenerate (e.g. collinear).
+ */
+cv::Mat estimateAffineTransformClosedForm(const std::vector<cv::Point2f> & src, const std::vector<cv::Point2f> & dst, const cv::Point2d & dst_center)
+{
+	CV_Assert(src.size() == dst.size() && !src.empty());
+	const size_t n = src.size();
+
+	// Center of source points
+	double mx = 0, my = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		mx += src[i].x;
+		my += src[i].y;
+	}
+	mx /= n;
+	my /= n;
+
+	// Second moments of centered source points and their cross moments with the destination points
+	double sxx = 0, sxy = 0, syy = 0, sxu = 0, syu = 0, sxv = 0, syv = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		const double x = src[i].x - mx;
+		const double y = src[i].y - my;
+		const double u = dst[i].x - dst_center.x;
+		const double v = dst[i].y - dst_center.y;
+		sxx += x * x;
+		sxy += x * y;
+		syy += y * y;
+		sxu += x * u;
+		syu += y * u;
+		sxv += x * v;
+		syv += y * v;
+	}
+
+	const double det = sxx * syy - sxy * sxy;
+	if (!(det > 1e-12 * sxx * syy))
+		return cv::Mat();
+	const double inv_det = 1.0 / det;
+
+	cv::Mat M(2, 3, CV_64F);
+	double * m = M.ptr<double>(0);
+	m[0] = (syy * sxu - sxy * syu) * inv_det;
+	m[1] = (sxx * syu - sxy * sxu) * inv_det;
+	m[2] = dst_center.x - m[0] * mx - m[1] * my;
+	m[3] = (syy * sxv - sxy * syv) * inv_det;
+	m[4] = (sxx * syv - sxy * sxv) * inv_det;
+	m[5] = dst_center.y - m[3] * mx - m[4] * my;
+	return M;
+}
+
 
 
 bool FaceRegistrationAffineMeanShape::init(const char * mean_shape_filename, const cv::Size & aligned_img_size, float eye_dist_frac)
@@ -76,17 +131,41 @@ bool FaceRegistrationAffineMeanShape::init(const char * mean_shape_filename, con
 	while (file >> x >> y)
 		mean_shape.push_back(cv::Point2f(x * x_scale + x_offset, y * y_scale + y_offset));
 
+	// The mean shape is constant, so its center (the offset of the closed form solution) is computed only once
+	mean_shape_center = cv::Point2d(0, 0);
+	for (size_t i = 0; i < mean_shape.size(); ++i)
+	{
+		mean_shape_center.x += mean_shape[i].x;
+		mean_shape_center.y += mean_shape[i].y;
+	}
+	if (!mean_shape.empty())
+		mean_shape_center *= 1.0 / mean_shape.size();
+
 	return !mean_shape.empty();
 }
 
+cv::Mat FaceRegistrationAffineMeanShape::estimate_transform(const std::vector<cv::Point2f> & in_landmarks) const
+{
+	bool fullAffine = false;
+	cv::Mat affine_transform;
+	if (closed_form)
+		affine_transform = estimateAffineTransformClosedForm(in_landmarks, mean_shape, mean_shape_center);
+	if (affine_transform.empty()) // SVD if selected or if the landmarks are degenerate
+		affine_transform = estimateAffineTransform(in_landmarks, mean_shape);
+#ifdef _DEBUG
+	else // Closed form and SVD solution must be equal up to rounding errors
+		CV_Assert(cv::norm(affine_transform, estimateAffineTransform(in_landmarks, mean_shape), cv::NORM_INF) < 1e-6 * (1.0 + cv::norm(affine_transform, cv::NORM_INF)));
+#endif
+	//cv::Mat affine_transform = cv::estimateRigidTransform(in_landmarks, mean_shape, fullAffine);
+	return affine_transform;
+}
+
 bool FaceRegistrationAffineMeanShape::register_face(const std::vector<cv::Point2f> & in_landmarks, const cv::Mat & in_image, cv::Mat * transformed_image, std::vector<cv::Point2f> * transformed_landmarks)
 {
 	if (mean_shape.size() != in_landmarks.size())
 		return false;
 
-	bool fullAffine = false;
-	cv::Mat affine_transform = estimateAffineTransform(in_landmarks, mean_shape);
-	//cv::Mat affine_transform = cv::estimateRigidTransform(in_landmarks, mean_shape, fullAffine);
+	cv::Mat affine_transform = estimate_transform(in_landmarks);
 	if (transformed_image)
 		cv::warpAffine(in_image, *transformed_image, affine_transform, output_size, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
 
@@ -97,6 +176,50 @@ bool FaceRegistrationAffineMeanShape::register_face(const std::vector<cv::Point2
 	return true;
 }
 
+bool FaceRegistrationAffineMeanShape::register_face_gray(const std::vector<cv::Point2f> & in_landmarks, const cv::Mat & in_image, cv::Mat & transformed_image, std::vector<cv::Point2f> * transformed_landmarks)
+{
+	if (mean_shape.size() != in_landmarks.size())
+		return false;
+
+	cv::Mat affine_transform = estimate_transform(in_landmarks);
+
+	if (transformed_landmarks)
+		cv::transform(in_landmarks, *transformed_landmarks, affine_transform);
+
+	if (in_image.channels() == 1)
+		cv::warpAffine(in_image, transformed_image, affine_transform, output_size, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+	else
+	{
+		// Bounding box of the source positions of the output pixels (corners mapped with the inverse transform),
+		// plus a margin for the bilinear interpolation
+		cv::Mat inverse_transform;
+		cv::invertAffineTransform(affine_transform, inverse_transform);
+		std::vector<cv::Point2f> corners(4), source_corners;
+		corners[1].x = corners[3].x = static_cast<float>(output_size.width - 1);
+		corners[2].y = corners[3].y = static_cast<float>(output_size.height - 1);
+		cv::transform(corners, source_corners, inverse_transform);
+		cv::Rect source_rect = cv::boundingRect(source_corners);
+		source_rect.x -= 2;
+		source_rect.y -= 2;
+		source_rect.width += 5;
+		source_rect.height += 5;
+
+		// Only pixels outside the image are cut off, these are replicated from the image border by warpAffine() anyway
+		source_rect &= cv::Rect(0, 0, in_image.cols, in_image.rows);
+		if (source_rect.area() == 0)
+			source_rect = cv::Rect(0, 0, in_image.cols, in_image.rows);
+
+		cv::cvtColor(in_image(source_rect), source_buffer.gray, in_image.channels() == 4 ? CV_BGRA2GRAY : CV_BGR2GRAY);
+
+		// Same transform relative to the source region
+		affine_transform.at<double>(0, 2) += affine_transform.at<double>(0, 0) * source_rect.x + affine_transform.at<double>(0, 1) * source_rect.y;
+		affine_transform.at<double>(1, 2) += affine_transform.at<double>(1, 0) * source_rect.x + affine_transform.at<double>(1, 1) * source_rect.y;
+		cv::warpAffine(source_buffer.gray, transformed_image, affine_transform, output_size, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+	}
+
+	return true;
+}
+
 bool FaceRegistrationAffineMeanShape::visualize_landmarks(cv::Mat & image, const std::vector<cv::Point2f> & landmarks, bool draw_mean_shape)
 {
 	for (size_t i = 0; i < landmarks.size(); ++i)
@@ -0,0 +1,227 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <dlib/dnn.h>
+#include <dlib/clustering.h>
+#include <dlib/image_processing.h>
+#include <dlib/opencv.h>
+
+#include <FaceBase/FaceLibDlib.hpp>
+
+#include "FacialActivityExtractor.hpp"
+#include "ExtractionModels.hpp"
+#include "Profiler.hpp"
+
+using namespace dlib;
+using namespace std;
+
+// Same settings as in recognizeFaces(): every 4th frame, at most max_faces face chips per video
+static const long max_faces = 50;
+
+const size_t FacialActivityExtractor::batch_size;
+
+FacialActivityExtractor::FacialActivityExtractor(const std::string& exdata_dir, const ExtractionOptions& options)
+	: m_options(options)
+{
+	std::string shape_predictor_file = exdata_dir + "spd+all=cascade30+oversampling70+trees1500.dat";
+	std::string mean_shape_file = exdata_dir + "mean_face_shape_intraface.dat";
+	std::string face_recognition_file = exdata_dir + "dlib_face_recognition_resnet_model_v1.dat";
+
+	m_detector = createFaceDetector(options.detector, exdata_dir);
+
+	deserialize(shape_predictor_file) >> m_sp;
+
+	DLIB_CASSERT(m_face_reg.init(mean_shape_file.c_str(), cv::Size(200, 200), 0.5),  "Error loading/initializing the face registration model: " << mean_shape_file);
+	m_face_reg.set_closed_form(!options.affine_svd);
+
+	loadAUModel(exdata_dir, m_AU);
+	configureAUModel(options, m_AU);
+
+	deserialize(face_recognition_file) >> m_face_rec_net;
+
+	init();
+}
+
+FacialActivityExtractor::FacialActivityExtractor(const FacialActivityExtractor& other)
+	: m_options(other.m_options),
+	  m_detector(other.m_detector->clone()),
+	  m_sp(other.m_sp),
+	  m_face_reg(other.m_face_reg),
+	  m_AU(other.m_AU),
+	  m_face_rec_net(other.m_face_rec_net)
+{
+	init();
+}
+
+void FacialActivityExtractor::init()
+{
+	// The video face detector refers to the detector of this extractor
+	m_video_face_detector = cv::Ptr<VideoFaceDetector>(new VideoFaceDetector(*m_detector, m_options.keyframe_interval, m_options.min_tracking_confidence, m_options.roi_scale));
+	m_AU.init_workspace(m_AU_workspace, cv::Size(200, 200), static_cast<int>(batch_size));
+	m_cv_images.resize(batch_size);
+	m_images.resize(batch_size);
+	m_faces_registered.resize(batch_size);
+	m_landmarks49_registered.resize(batch_size);
+	begin_video();
+}
+
+void FacialActivityExtractor::begin_video(int outputs)
+{
+	m_outputs = outputs;
+	m_video_face_detector->reset();
+	m_num_buffered = 0;
+	m_face_chips.clear();
+	m_activity = FacialActivity();
+	if (m_outputs & OUTPUT_AUS)
+	{
+		m_activity.AU_ids = m_AU.get_AUIds();
+		m_activity.AU_intensities.create(0, num_AUs(), CV_32F);
+	}
+}
+
+void FacialActivityExtractor::push_frame(const cv::Mat& frame)
+{
+	CV_Assert(frame.type() == CV_8UC3);
+	frame.copyTo(m_cv_images[m_num_buffered]);
+	add_buffered_frame();
+}
+
+void FacialActivityExtractor::add_buffered_frame()
+{
+	// Frames are buffered in both formats: dlib for detection, landmarks, and face chips; opencv for registration.
+	if (m_images.size() <= m_num_buffered)
+		m_images.resize(m_num_buffered + 1);
+	dlib::assign_image(m_images[m_num_buffered], dlib::cv_image<dlib::bgr_pixel>(m_cv_images[m_num_buffered]));
+	if (++m_num_buffered == batch_size)
+		process_batch();
+}
+
+void FacialActivityExtractor::process_batch()
+{
+	if (m_num_buffered == 0)
+		return;
+	m_images.resize(m_num_buffered);
+	m_faces_registered.resize(m_num_buffered);
+	m_landmarks49_registered.resize(m_num_buffered);
+
+	// Get detections
+	profiler::Timer detection_timer("face_detection");
+	m_video_face_detector->detect(m_images, m_faces_det);
+	detection_timer.stop();
+
+	const bool need_landmarks = (m_outputs & (OUTPUT_LANDMARKS | OUTPUT_AUS | OUTPUT_IDENTITY)) != 0;
+	for (size_t i = 0; i < m_num_buffered; ++i, ++m_activity.num_frames)
+	{
+		const dlib::rectangle& det = m_faces_det[i];
+		if (m_outputs & OUTPUT_FACES)
+			m_activity.faces.push_back(det);
+		if (!need_landmarks)
+			continue;
+
+		// Get landmarks
+		profiler::Timer sp_timer("shape_predictor");
+		dlib::full_object_detection shape = m_sp(m_images[i], det);
+		sp_timer.stop();
+
+		if (m_outputs & OUTPUT_AUS)
+		{
+			// 1. From dlib to opencv
+			m_landmarks68.clear();
+			for (long part_no = 0; part_no < shape.num_parts(); ++part_no)
+				m_landmarks68.push_back(cv::Point2f(shape.part(part_no).x(), shape.part(part_no).y()));
+			// 2. From 68 to 49 (inner landmarks)
+			FaceLibDlib::conv_landmarks_68_to_49(m_landmarks68, m_landmarks49);
+
+			// Register face
+			profiler::Timer reg_timer("register_face");
+			if (m_options.gray_warp)
+				m_face_reg.register_face_gray(m_landmarks49, m_cv_images[i], m_faces_registered[i], &m_landmarks49_registered[i]);
+			else
+				m_face_reg.register_face(m_landmarks49, m_cv_images[i], &m_faces_registered[i], &m_landmarks49_registered[i]);
+		}
+
+		// Take every 4th frame of the first frames for face recognition
+		const long frame_no = m_activity.num_frames;
+		if ((m_outputs & OUTPUT_IDENTITY) && frame_no % 4 == 0 && frame_no / 4.0 < max_faces)
+		{
+			profiler::Timer chip_timer("face_chip");
+			auto face_details = get_face_chip_details(shape, 150, 0.25);
+			m_face_chips.push_back(image_type());
+			extract_image_chip(m_images[i], face_details, m_face_chips.back());
+		}
+
+		if (m_outputs & OUTPUT_LANDMARKS)
+			m_activity.landmarks.push_back(std::move(shape));
+	}
+
+	// Estimate AU Intensity of the whole batch
+	if (m_outputs & OUTPUT_AUS)
+	{
+		DLIB_CASSERT(m_AU.estimate_batch(m_faces_registered, m_landmarks49_registered, m_AU_detections, m_AU_workspace), "AU estimation failed in frame " << m_activity.num_frames);
+		DLIB_CASSERT(m_AU_detections.cols == num_AUs(), "Unexpected number of AUs in frame " << m_activity.num_frames);
+		m_activity.AU_intensities.push_back(m_AU_detections);
+	}
+	m_num_buffered = 0;
+}
+
+FacialActivity FacialActivityExtractor::end_video()
+{
+	process_batch();
+	if ((m_outputs & OUTPUT_IDENTITY) && !m_face_chips.empty())
+	{
+		m_activity.first_face = m_face_chips.front();
+
+		// Perform face recognition
+		profiler::Timer rec_timer("face_recognition");
+		m_activity.face_descriptors = m_face_rec_net(m_face_chips);
+	}
+	FacialActivity activity = std::move(m_activity);
+	begin_video(m_outputs);
+	return activity;
+}
+
+FacialActivity FacialActivityExtractor::process_video(const std::string& filename, int outputs)
+{
+	begin_video(outputs);
+
+	cv::VideoCapture vid(filename);
+	DLIB_CASSERT(vid.isOpened(), "Cannot open video filename : " << filename);
+
+	// The frames are decoded into the batch buffer directly
+	while (true)
+	{
+		profiler::Timer decode_timer("decode");
+		if (!vid.read(m_cv_images[m_num_buffered]))
+			break;
+		decode_timer.stop();
+		profiler::add_frames(1);
+		add_buffered_frame();
+	}
+	return end_video();
+}
+
+std::vector<unsigned long> FacialActivityExtractor::cluster_identities(const std::vector<std::vector<FacialActivity::descriptor_type>>& face_descriptors, long num_identities)
+{
+	typedef std::vector<FacialActivity::descriptor_type> vec_sample_type;
+
+	// Similarity of two videos: inverse of the median distance between their face descriptors
+	auto dist_function = [](const vec_sample_type& a, const vec_sample_type&b)
+	{
+		std::vector<double> dists;
+		for (size_t i = 0; i < a.size(); ++i)
+		    for (size_t j = 0; j < b.size(); ++j)
+			dists.push_back(length(a[i]-b[j]));
+		std::sort(dists.begin(),dists.end());
+ 		double median = dists.at(dists.size() / 2);
+		return 1.0 / (median + 0.00001);
+	};
+
+	return spectral_cluster(dist_function, face_descriptors, num_identities);
+}
@@ -0,0 +1,124 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "LandmarkCache.hpp"
+#include <BinaryFile/BinaryFile.hpp>
+#include <memory>
+
+namespace
+{
+	const uint32_t landmark_cache_magic = 0x43444D4C; // "LMDC"
+	const uint32_t landmark_cache_version = 1;
+}
+
+LandmarkCacheWriter::LandmarkCacheWriter(const std::string & filename, long num_videos, long num_points)
+	: m_file(NULL), m_num_points(num_points), m_okay(true)
+{
+	m_file = BinaryFile::open(filename, false);
+	if (!m_file)
+		return;
+
+	m_okay &= BinaryFile::write_one(m_file, landmark_cache_magic);
+	m_okay &= BinaryFile::write_one(m_file, landmark_cache_version);
+	m_okay &= BinaryFile::write_one(m_file, uint32_t(num_videos));
+	m_okay &= BinaryFile::write_one(m_file, uint32_t(num_points));
+}
+
+void LandmarkCacheWriter::append(const dlib::full_object_detection & shape, std::vector<int16_t> & video_points)
+{
+	for (unsigned long part_no = 0; part_no < shape.num_parts(); ++part_no)
+	{
+		video_points.push_back(static_cast<int16_t>(shape.part(part_no).x()));
+		video_points.push_back(static_cast<int16_t>(shape.part(part_no).y()));
+	}
+}
+
+void LandmarkCacheWriter::write(long vid_id, std::vector<int16_t> video_points)
+{
+	auto points = std::make_shared<std::vector<int16_t>>(std::move(video_points));
+	m_commit.commit(vid_id, [this, vid_id, points]()
+	{
+		if (!m_file)
+			return;
+		m_okay &= BinaryFile::write_one(m_file, uint32_t(vid_id));
+		m_okay &= BinaryFile::write_one(m_file, uint32_t(points->size() / (2 * m_num_points)));
+		m_okay &= BinaryFile::write_n(m_file, points->data(), points->size());
+	});
+}
+
+bool LandmarkCacheWriter::close()
+{
+	if (m_file)
+	{
+		m_okay &= BinaryFile::close(m_file);
+		m_file = NULL;
+	}
+	return m_okay;
+}
+
+LandmarkCacheReader::LandmarkCacheReader(const std::string & filename)
+	: m_file(NULL), m_num_points(0)
+{
+	m_file = BinaryFile::open(filename, true);
+	if (!m_file)
+		return;
+
+	bool okay = true;
+	uint32_t magic = 0, version = 0, num_videos = 0, num_points = 0;
+	okay &= BinaryFile::read_one(m_file, magic);
+	okay &= BinaryFile::read_one(m_file, version);
+	okay &= BinaryFile::read_one(m_file, num_videos);
+	okay &= BinaryFile::read_one(m_file, num_points);
+	okay &= magic == landmark_cache_magic && version == landmark_cache_version;
+	m_num_points = num_points;
+
+	// Index the video blocks
+	for (uint32_t i = 0; okay && i < num_videos; ++i)
+	{
+		uint32_t vid_id = 0, num_frames = 0;
+		okay &= BinaryFile::read_one(m_file, vid_id);
+		okay &= BinaryFile::read_one(m_file, num_frames);
+		okay &= vid_id == i;
+		if (!okay)
+			break;
+		m_offsets.push_back(std::ftell(m_file));
+		m_num_frames.push_back(num_frames);
+		okay &= std::fseek(m_file, long(num_frames) * m_num_points * 2 * sizeof(int16_t), SEEK_CUR) == 0;
+	}
+
+	// Incomplete or corrupt files are not used at all
+	if (!okay || m_offsets.size() != num_videos)
+	{
+		BinaryFile::close(m_file);
+		m_file = NULL;
+		m_offsets.clear();
+		m_num_frames.clear();
+	}
+}
+
+LandmarkCacheReader::~LandmarkCacheReader()
+{
+	if (m_file)
+		BinaryFile::close(m_file);
+}
+
+bool LandmarkCacheReader::read(long vid_id, std::vector<int16_t> & video_points)
+{
+	if (!m_file || vid_id < 0 || vid_id >= num_videos())
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	video_points.resize(m_num_frames[vid_id] * m_num_points * 2);
+	if (std::fseek(m_file, m_offsets[vid_id], SEEK_SET) != 0)
+		return false;
+	return BinaryFile::read_n(m_file, video_points.data(), video_points.size());
+}
+
+dlib::full_object_detection LandmarkCacheReader::get_shape(const std::vector<int16_t> & video_points, long frame_no, const dlib::rectangle & rect) const
+{
+	std::vector<dlib::point> parts(m_num_points);
+	const int16_t * p = video_points.data() + frame_no * m_num_points * 2;
+	for (long part_no = 0; part_no < m_num_points; ++part_no, p += 2)
+		parts[part_no] = dlib::point(p[0], p[1]);
+	return dlib::full_object_detection(rect, parts);
+}
@@ -0,0 +1,106 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+// AVX2 row kernel of the 8 neighbors / radius 1 LBP operator (compiled with -mavx2, see CMakeLists.txt).
+// Same as the SSE4.1 kernel, but interpolates 4 pixels per instruction.
+
+#include <ActionUnitIntensityEstimation/LbpSimd.hpp>
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace {
+
+// Comparison of interpolated neighbor and center for 4 pixels, returns -1 (true) or 0 (false) per int32.
+// The operations are the same (and in the same order) as in lbp_compare<true>() in AU.cpp.
+inline __m128i interpolated_ge_4(__m128i a, __m128i b, __m128i c, __m128i d, __m128i center, const double* w)
+{
+	const __m256d scale = _mm256_set1_pd(1.0 / 256.0);
+	__m256d n = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(a), scale), _mm256_set1_pd(w[0])), _mm256_mul_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(b), scale), _mm256_set1_pd(w[1])));
+	n = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(c), scale), _mm256_set1_pd(w[2])), n);
+	n = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(d), scale), _mm256_set1_pd(w[3])), n);
+	// roundn(n, -4) * 10000
+	const __m128i r = _mm256_cvtpd_epi32(_mm256_mul_pd(n, _mm256_set1_pd(10000.0)));
+	// 16 * r >= 625 * center
+	return _mm_cmpgt_epi32(_mm_slli_epi32(r, 4), _mm_sub_epi32(_mm_mullo_epi32(center, _mm_set1_epi32(625)), _mm_set1_epi32(1)));
+}
+
+// 16 pixels as 4 x 4 int32
+inline void widen(__m128i v, __m128i q[4])
+{
+	q[0] = _mm_cvtepu8_epi32(v);
+	q[1] = _mm_cvtepu8_epi32(_mm_srli_si128(v, 4));
+	q[2] = _mm_cvtepu8_epi32(_mm_srli_si128(v, 8));
+	q[3] = _mm_cvtepu8_epi32(_mm_srli_si128(v, 12));
+}
+
+inline __m128i load(const unsigned char* p)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// Comparison of interpolated neighbor and center for 16 pixels, returns 0xFF (true) or 0 (false) per byte
+inline __m128i interpolated_ge_16(const unsigned char* p, const std::ptrdiff_t* offsets, const double* w, const __m128i center[4])
+{
+	__m128i a[4], b[4], c[4], d[4];
+	widen(load(p + offsets[0]), a);
+	widen(load(p + offsets[1]), b);
+	widen(load(p + offsets[2]), c);
+	widen(load(p + offsets[3]), d);
+	const __m128i ge0 = interpolated_ge_4(a[0], b[0], c[0], d[0], center[0], w);
+	const __m128i ge1 = interpolated_ge_4(a[1], b[1], c[1], d[1], center[1], w);
+	const __m128i ge2 = interpolated_ge_4(a[2], b[2], c[2], d[2], center[2], w);
+	const __m128i ge3 = interpolated_ge_4(a[3], b[3], c[3], d[3], center[3], w);
+	return _mm_packs_epi16(_mm_packs_epi32(ge0, ge1), _mm_packs_epi32(ge2, ge3));
+}
+
+}
+
+int lbp_8_1_row_avx2(const unsigned char* p, int n, const LbpPattern8& pattern, bool interpolate_diagonals, unsigned char* codes)
+{
+	if(n < 16)
+		return 0;
+
+	for(int k = 0; ; k += 16)
+	{
+		// The last chunk overlaps with the previous one if n is not a multiple of 16
+		if(k > n - 16)
+			k = n - 16;
+
+		const unsigned char* pc = p + k;
+		const __m128i center = load(pc);
+		__m128i center32[4];
+		if(interpolate_diagonals)
+			widen(center, center32);
+
+		__m128i code = _mm_setzero_si128();
+		for(int i = 0; i < 8; i++)
+		{
+			__m128i ge;
+			if(interpolate_diagonals && (i & 1))
+				ge = interpolated_ge_16(pc, pattern.offsets[i], pattern.weights[i], center32);
+			else
+			{
+				// neighbor >= center (unsigned)
+				const __m128i neighbor = load(pc + pattern.offsets[i][0]);
+				ge = _mm_cmpeq_epi8(_mm_max_epu8(neighbor, center), neighbor);
+			}
+			code = _mm_or_si128(code, _mm_and_si128(ge, _mm_set1_epi8(static_cast<char>(1 << i))));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(codes + k), code);
+
+		if(k == n - 16)
+			break;
+	}
+	return n;
+}
+
+#else
+
+int lbp_8_1_row_avx2(const unsigned char*, int, const LbpPattern8&, bool, unsigned char*)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,76 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "MemoryMappedFile.hpp"
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MEMORY_MAPPED_FILE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool MemoryMappedFile::open(const std::string & filename)
+{
+	close();
+
+#ifdef MEMORY_MAPPED_FILE_MMAP
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // The mapping stays valid
+	if(data == MAP_FAILED)
+		return false;
+
+	m_data = static_cast<const unsigned char *>(data);
+	m_size = st.st_size;
+	m_mapped = true;
+	return true;
+#else
+	std::FILE * file = std::fopen(filename.c_str(), "rb");
+	if(!file)
+		return false;
+
+	bool okay = std::fseek(file, 0, SEEK_END) == 0;
+	long size = okay ? std::ftell(file) : -1;
+	okay = size > 0 && std::fseek(file, 0, SEEK_SET) == 0;
+	if(okay)
+	{
+		m_buffer.resize((size + sizeof(double) - 1) / sizeof(double));
+		okay = std::fread(&m_buffer[0], 1, size, file) == static_cast<size_t>(size);
+	}
+	std::fclose(file);
+	if(!okay)
+	{
+		m_buffer.clear();
+		return false;
+	}
+
+	m_data = reinterpret_cast<const unsigned char *>(&m_buffer[0]);
+	m_size = size;
+	return true;
+#endif
+}
+
+void MemoryMappedFile::close()
+{
+#ifdef MEMORY_MAPPED_FILE_MMAP
+	if(m_mapped)
+		munmap(const_cast<unsigned char *>(m_data), m_size);
+#endif
+	m_buffer.clear();
+	m_data = NULL;
+	m_size = 0;
+	m_mapped = false;
+}
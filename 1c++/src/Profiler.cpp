@@ -0,0 +1,341 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "Profiler.hpp"
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdint.h>
+
+namespace profiler
+{
+namespace
+{
+	typedef std::chrono::steady_clock steady_clock;
+
+	// Latencies (in ms) of the timed sections by name
+	typedef std::map<std::string, std::vector<float>> Sections;
+
+	struct Event
+	{
+		const char * name;
+		int stage;
+		long vid_id;
+		int thread_id;
+		int64_t start_us;
+		int64_t duration_us;
+	};
+
+	struct SectionSummary
+	{
+		std::string name;
+		size_t count;
+		double total_ms, p50_ms, p95_ms, p99_ms;
+	};
+
+	struct VideoSummary
+	{
+		long vid_id;
+		long num_frames;
+		double seconds;
+		std::vector<SectionSummary> sections;
+	};
+
+	struct Stage
+	{
+		std::string name;
+		double seconds = 0.0;
+		long num_frames = 0;
+		Sections sections;
+		std::vector<VideoSummary> videos;
+	};
+
+	struct State
+	{
+		std::atomic<bool> enabled{false};
+		bool trace = false;
+		steady_clock::time_point time_start;
+		std::atomic<int> num_threads{0};
+		std::mutex mutex;
+		std::deque<Stage> stages;	// The current stage is the last one (deque: the names of the events stay valid)
+		std::vector<Event> events;
+	};
+
+	State & state()
+	{
+		static State s;
+		return s;
+	}
+
+	// Sections and frames of the video processed by the calling thread
+	struct ThreadState
+	{
+		int thread_id = -1;
+		bool in_video = false;
+		long vid_id = -1;
+		long num_frames = 0;
+		Sections sections;
+		std::vector<Event> events;
+	};
+
+	ThreadState & thread_state()
+	{
+		thread_local ThreadState ts;
+		if (ts.thread_id < 0)
+			ts.thread_id = state().num_threads++;
+		return ts;
+	}
+
+	int64_t microseconds(steady_clock::time_point t)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(t - state().time_start).count();
+	}
+
+	// Nearest rank percentile of sorted values
+	double percentile(const std::vector<float> & sorted, double p)
+	{
+		if (sorted.empty())
+			return 0.0;
+		const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+		return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+	}
+
+	std::vector<SectionSummary> summarize(const Sections & sections)
+	{
+		std::vector<SectionSummary> summaries;
+		std::vector<float> sorted;
+		for (const auto & section : sections)
+		{
+			sorted = section.second;
+			std::sort(sorted.begin(), sorted.end());
+			SectionSummary s;
+			s.name = section.first;
+			s.count = sorted.size();
+			s.total_ms = 0.0;
+			for (float ms : sorted)
+				s.total_ms += ms;
+			s.p50_ms = percentile(sorted, 0.50);
+			s.p95_ms = percentile(sorted, 0.95);
+			s.p99_ms = percentile(sorted, 0.99);
+			summaries.push_back(s);
+		}
+		return summaries;
+	}
+
+	void record(const char * name, steady_clock::time_point start, steady_clock::time_point stop)
+	{
+		State & s = state();
+		ThreadState & ts = thread_state();
+		const float ms = std::chrono::duration<float, std::milli>(stop - start).count();
+		Event event = { name, 0, ts.in_video ? ts.vid_id : -1, ts.thread_id, microseconds(start), microseconds(stop) - microseconds(start) };
+		if (ts.in_video)
+		{
+			ts.sections[name].push_back(ms);
+			if (s.trace)
+				ts.events.push_back(event);
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(s.mutex);
+		if (s.stages.empty())
+			return;
+		s.stages.back().sections[name].push_back(ms);
+		if (s.trace)
+		{
+			event.stage = static_cast<int>(s.stages.size()) - 1;
+			s.events.push_back(event);
+		}
+	}
+
+	void write_sections(std::ostream & os, const std::vector<SectionSummary> & sections, const char * indent)
+	{
+		os << "[";
+		for (size_t i = 0; i < sections.size(); ++i)
+		{
+			const SectionSummary & s = sections[i];
+			os << (i ? "," : "") << "\n" << indent << "{\"name\": \"" << s.name << "\", \"count\": " << s.count << ", \"total_ms\": " << s.total_ms
+			   << ", \"p50_ms\": " << s.p50_ms << ", \"p95_ms\": " << s.p95_ms << ", \"p99_ms\": " << s.p99_ms << "}";
+		}
+		os << "]";
+	}
+}
+
+void enable(bool trace)
+{
+	State & s = state();
+	s.time_start = steady_clock::now();
+	s.trace = trace;
+	s.enabled = true;
+}
+
+bool is_enabled()
+{
+	return state().enabled;
+}
+
+Timer::Timer(const char * name)
+	: m_name(is_enabled() ? name : NULL)
+{
+	if (m_name)
+		m_start = steady_clock::now();
+}
+
+void Timer::stop()
+{
+	if (!m_name)
+		return;
+	record(m_name, m_start, steady_clock::now());
+	m_name = NULL;
+}
+
+VideoScope::VideoScope(long vid_id)
+	: m_enabled(is_enabled())
+{
+	if (!m_enabled)
+		return;
+	ThreadState & ts = thread_state();
+	ts.in_video = true;
+	ts.vid_id = vid_id;
+	ts.num_frames = 0;
+	ts.sections.clear();
+	ts.events.clear();
+	m_start = steady_clock::now();
+}
+
+VideoScope::~VideoScope()
+{
+	if (!m_enabled)
+		return;
+	const steady_clock::time_point stop = steady_clock::now();
+	record("video", m_start, stop);
+
+	State & s = state();
+	ThreadState & ts = thread_state();
+	ts.in_video = false;
+
+	VideoSummary video;
+	video.vid_id = ts.vid_id;
+	video.num_frames = ts.num_frames;
+	video.seconds = std::chrono::duration<double>(stop - m_start).count();
+	video.sections = summarize(ts.sections);
+
+	std::lock_guard<std::mutex> lock(s.mutex);
+	if (s.stages.empty())
+		return;
+	Stage & stage = s.stages.back();
+	stage.num_frames += ts.num_frames;
+	stage.videos.push_back(std::move(video));
+	for (auto & section : ts.sections)
+	{
+		std::vector<float> & latencies = stage.sections[section.first];
+		latencies.insert(latencies.end(), section.second.begin(), section.second.end());
+	}
+	for (Event & event : ts.events)
+	{
+		event.stage = static_cast<int>(s.stages.size()) - 1;
+		s.events.push_back(event);
+	}
+	ts.sections.clear();
+	ts.events.clear();
+}
+
+StageScope::StageScope(const std::string & name)
+	: m_enabled(is_enabled())
+{
+	if (!m_enabled)
+		return;
+	State & s = state();
+	std::lock_guard<std::mutex> lock(s.mutex);
+	s.stages.push_back(Stage());
+	s.stages.back().name = name;
+	m_start = steady_clock::now();
+}
+
+StageScope::~StageScope()
+{
+	if (!m_enabled)
+		return;
+	State & s = state();
+	const steady_clock::time_point stop = steady_clock::now();
+	std::lock_guard<std::mutex> lock(s.mutex);
+	Stage & stage = s.stages.back();
+	stage.seconds = std::chrono::duration<double>(stop - m_start).count();
+	if (s.trace)
+	{
+		Event event = { stage.name.c_str(), static_cast<int>(s.stages.size()) - 1, -1, thread_state().thread_id, microseconds(m_start), microseconds(stop) - microseconds(m_start) };
+		s.events.push_back(event);
+	}
+}
+
+void add_frames(long num_frames)
+{
+	if (!is_enabled())
+		return;
+	ThreadState & ts = thread_state();
+	if (ts.in_video)
+	{
+		ts.num_frames += num_frames;
+		return;
+	}
+	State & s = state();
+	std::lock_guard<std::mutex> lock(s.mutex);
+	if (!s.stages.empty())
+		s.stages.back().num_frames += num_frames;
+}
+
+bool write_summary(const std::string & filename)
+{
+	State & s = state();
+	std::lock_guard<std::mutex> lock(s.mutex);
+	std::ofstream file(filename);
+	if (!file.is_open())
+		return false;
+
+	file << "{\"stages\": [";
+	for (size_t i = 0; i < s.stages.size(); ++i)
+	{
+		const Stage & stage = s.stages[i];
+		file << (i ? "," : "") << "\n  {\"name\": \"" << stage.name << "\", \"seconds\": " << stage.seconds << ", \"frames\": " << stage.num_frames
+		     << ", \"frames_per_second\": " << (stage.seconds > 0 ? stage.num_frames / stage.seconds : 0.0) << ",\n   \"sections\": ";
+		write_sections(file, summarize(stage.sections), "    ");
+		file << ",\n   \"videos\": [";
+		for (size_t j = 0; j < stage.videos.size(); ++j)
+		{
+			const VideoSummary & video = stage.videos[j];
+			file << (j ? "," : "") << "\n    {\"vid_id\": " << video.vid_id << ", \"frames\": " << video.num_frames << ", \"seconds\": " << video.seconds
+			     << ", \"frames_per_second\": " << (video.seconds > 0 ? video.num_frames / video.seconds : 0.0) << ", \"sections\": ";
+			write_sections(file, video.sections, "      ");
+			file << "}";
+		}
+		file << "]}";
+	}
+	file << "\n]}\n";
+	file.close();
+	return !file.fail();
+}
+
+bool write_trace(const std::string & filename)
+{
+	State & s = state();
+	std::lock_guard<std::mutex> lock(s.mutex);
+	std::ofstream file(filename);
+	if (!file.is_open())
+		return false;
+
+	file << "{\"traceEvents\": [";
+	for (size_t i = 0; i < s.events.size(); ++i)
+	{
+		const Event & event = s.events[i];
+		file << (i ? "," : "") << "\n{\"name\": \"" << event.name << "\", \"cat\": \"" << s.stages[event.stage].name << "\", \"ph\": \"X\", \"ts\": " << event.start_us
+		     << ", \"dur\": " << event.duration_us << ", \"pid\": 1, \"tid\": " << event.thread_id << ", \"args\": {\"vid_id\": " << event.vid_id << "}}";
+	}
+	file << "\n]}\n";
+	file.close();
+	return !file.fail();
+}
+}
@@ -0,0 +1,64 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+// AVX2 dot products of the quantized AU regression (compiled with -mavx2, see CMakeLists.txt)
+
+#include <ActionUnitIntensityEstimation/QuantizedDot.hpp>
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace {
+
+inline int32_t horizontal_sum(__m256i v)
+{
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+	s = _mm_add_epi32(s, _mm_srli_si128(s, 4));
+	return _mm_cvtsi128_si32(s);
+}
+
+}
+
+int quantized_dot16_avx2(const int16_t* hist, const int16_t* weights, int n, int32_t& sum)
+{
+	__m256i acc = _mm256_setzero_si256();
+	int k = 0;
+	for(; k <= n - 16; k += 16)
+	{
+		const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hist + k));
+		const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + k));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(h, w));
+	}
+	sum += horizontal_sum(acc);
+	return k;
+}
+
+int quantized_dot8_avx2(const int16_t* hist, const int8_t* weights, int n, int32_t& sum)
+{
+	__m256i acc = _mm256_setzero_si256();
+	int k = 0;
+	for(; k <= n - 16; k += 16)
+	{
+		const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hist + k));
+		const __m256i w = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + k)));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(h, w));
+	}
+	sum += horizontal_sum(acc);
+	return k;
+}
+
+#else
+
+int quantized_dot16_avx2(const int16_t*, const int16_t*, int, int32_t&)
+{
+	return 0;
+}
+
+int quantized_dot8_avx2(const int16_t*, const int8_t*, int, int32_t&)
+{
+	return 0;
+}
+
+#endif
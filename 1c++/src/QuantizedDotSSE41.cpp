@@ -0,0 +1,67 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+// SSE4.1 dot products of the quantized AU regression (compiled with -msse4.1, see CMakeLists.txt)
+
+#include <ActionUnitIntensityEstimation/QuantizedDot.hpp>
+
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+
+#include <smmintrin.h>
+
+namespace {
+
+inline __m128i load(const void* p)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+inline int32_t horizontal_sum(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_srli_si128(v, 8));
+	v = _mm_add_epi32(v, _mm_srli_si128(v, 4));
+	return _mm_cvtsi128_si32(v);
+}
+
+}
+
+int quantized_dot16_sse41(const int16_t* hist, const int16_t* weights, int n, int32_t& sum)
+{
+	__m128i acc = _mm_setzero_si128();
+	int k = 0;
+	for(; k <= n - 16; k += 16)
+	{
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(load(hist + k), load(weights + k)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(load(hist + k + 8), load(weights + k + 8)));
+	}
+	sum += horizontal_sum(acc);
+	return k;
+}
+
+int quantized_dot8_sse41(const int16_t* hist, const int8_t* weights, int n, int32_t& sum)
+{
+	__m128i acc = _mm_setzero_si128();
+	int k = 0;
+	for(; k <= n - 16; k += 16)
+	{
+		const __m128i w = load(weights + k);
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(load(hist + k), _mm_cvtepi8_epi16(w)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(load(hist + k + 8), _mm_cvtepi8_epi16(_mm_srli_si128(w, 8))));
+	}
+	sum += horizontal_sum(acc);
+	return k;
+}
+
+#else
+
+int quantized_dot16_sse41(const int16_t*, const int16_t*, int, int32_t&)
+{
+	return 0;
+}
+
+int quantized_dot8_sse41(const int16_t*, const int8_t*, int, int32_t&)
+{
+	return 0;
+}
+
+#endif
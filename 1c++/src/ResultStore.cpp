@@ -0,0 +1,394 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include "ResultStore.hpp"
+#include <BinaryFile/BinaryFile.hpp>
+#include <dlib/assert.h>
+#include <fstream>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+	const uint32_t result_store_magic = 0x54534552; // "REST"
+	const uint32_t result_store_version = 1;
+
+	// Write n values of the given column type
+	bool write_values(std::FILE * file, ResultColumn::Type type, const std::vector<char> & data)
+	{
+		switch (type)
+		{
+		case ResultColumn::INT16:
+			return BinaryFile::write_n(file, reinterpret_cast<const int16_t *>(data.data()), data.size() / sizeof(int16_t));
+		case ResultColumn::INT32:
+			return BinaryFile::write_n(file, reinterpret_cast<const int32_t *>(data.data()), data.size() / sizeof(int32_t));
+		case ResultColumn::FLOAT32:
+			return BinaryFile::write_n(file, reinterpret_cast<const float *>(data.data()), data.size() / sizeof(float));
+		}
+		return false;
+	}
+
+	// Read the header (magic, version, number of videos and columns), returns false if it is invalid
+	bool read_header(std::FILE * file, uint32_t & num_videos, std::vector<ResultColumn> & columns)
+	{
+		bool okay = true;
+		uint32_t magic = 0, version = 0, num_columns = 0;
+		okay &= BinaryFile::read_one(file, magic);
+		okay &= BinaryFile::read_one(file, version);
+		okay &= BinaryFile::read_one(file, num_videos);
+		okay &= BinaryFile::read_one(file, num_columns);
+		okay &= magic == result_store_magic && version == result_store_version;
+
+		columns.clear();
+		for (uint32_t i = 0; okay && i < num_columns; ++i)
+		{
+			uint32_t type = 0, width = 0, name_length = 0;
+			okay &= BinaryFile::read_one(file, type);
+			okay &= BinaryFile::read_one(file, width);
+			okay &= BinaryFile::read_one(file, name_length);
+			okay &= type <= ResultColumn::FLOAT32 && name_length < 256;
+			std::string name(okay ? name_length : 0, ' ');
+			okay = okay && BinaryFile::read_n(file, &name[0], name.size());
+			columns.push_back(ResultColumn(name, ResultColumn::Type(type), width));
+		}
+		return okay;
+	}
+}
+
+std::vector<ResultColumn> face_detection_columns()
+{
+	return std::vector<ResultColumn>(1, ResultColumn("box", ResultColumn::INT32, 4));
+}
+
+std::vector<ResultColumn> au_columns(long num_AUs)
+{
+	return std::vector<ResultColumn>(1, ResultColumn("au", ResultColumn::FLOAT32, num_AUs));
+}
+
+ResultVideo::ResultVideo(const std::vector<ResultColumn> & columns)
+	: m_columns(columns), m_data(columns.size())
+{
+}
+
+void ResultVideo::append(size_t column, ResultColumn::Type type, const void * values)
+{
+	const ResultColumn & col = m_columns.at(column);
+	DLIB_CASSERT(col.type == type, "Type mismatch in column " << col.name);
+	std::vector<char> & data = m_data[column];
+	const size_t size = col.width * col.value_size();
+	data.resize(data.size() + size);
+	std::memcpy(data.data() + data.size() - size, values, size);
+}
+
+void ResultVideo::append(size_t column, const int16_t * values)
+{
+	append(column, ResultColumn::INT16, values);
+}
+
+void ResultVideo::append(size_t column, const int32_t * values)
+{
+	append(column, ResultColumn::INT32, values);
+}
+
+void ResultVideo::append(size_t column, const float * values)
+{
+	append(column, ResultColumn::FLOAT32, values);
+}
+
+long ResultVideo::num_frames() const
+{
+	if (m_columns.empty() || m_columns[0].width == 0)
+		return 0;
+	return m_data[0].size() / (m_columns[0].width * m_columns[0].value_size());
+}
+
+ResultStoreWriter::ResultStoreWriter(const std::string & filename, long num_videos, const std::vector<ResultColumn> & columns)
+	: m_file(NULL), m_manifest_filename(filename + ".manifest"), m_num_videos(num_videos), m_columns(columns), m_okay(true)
+{
+	m_file = BinaryFile::open(filename, false);
+	if (!m_file)
+		return;
+	m_manifest.open(m_manifest_filename, std::ios::trunc);
+	m_okay &= m_manifest.is_open();
+
+	m_okay &= BinaryFile::write_one(m_file, result_store_magic);
+	m_okay &= BinaryFile::write_one(m_file, result_store_version);
+	m_okay &= BinaryFile::write_one(m_file, uint32_t(num_videos));
+	m_okay &= BinaryFile::write_one(m_file, uint32_t(columns.size()));
+	for (const auto & column : columns)
+	{
+		m_okay &= BinaryFile::write_one(m_file, uint32_t(column.type));
+		m_okay &= BinaryFile::write_one(m_file, uint32_t(column.width));
+		m_okay &= BinaryFile::write_one(m_file, uint32_t(column.name.size()));
+		m_okay &= BinaryFile::write_n(m_file, column.name.data(), column.name.size());
+	}
+}
+
+void ResultStoreWriter::write(long vid_id, ResultVideo video)
+{
+	auto data = std::make_shared<ResultVideo>(std::move(video));
+	m_commit.commit(vid_id, [this, vid_id, data]()
+	{
+		if (!m_file)
+			return;
+
+		// All columns must have the same number of frames
+		const long num_frames = data->num_frames();
+		m_offsets.push_back(std::ftell(m_file));
+		m_num_frames.push_back(uint32_t(num_frames));
+		for (size_t i = 0; i < m_columns.size(); ++i)
+		{
+			m_okay &= data->m_data[i].size() == num_frames * m_columns[i].width * m_columns[i].value_size();
+			m_okay &= write_values(m_file, m_columns[i].type, data->m_data[i]);
+		}
+
+		// The video is listed in the manifest after its data is in the file
+		m_okay &= std::fflush(m_file) == 0;
+		m_manifest << vid_id << " " << m_offsets.back() << " " << m_num_frames.back() << "\n";
+		m_manifest.flush();
+		m_okay &= bool(m_manifest);
+	});
+}
+
+bool ResultStoreWriter::close()
+{
+	if (m_file)
+	{
+		// Only complete files get an index
+		m_okay &= long(m_offsets.size()) == m_num_videos;
+		if (m_okay)
+		{
+			const uint64_t index_offset = std::ftell(m_file);
+			for (size_t i = 0; i < m_offsets.size(); ++i)
+			{
+				m_okay &= BinaryFile::write_one(m_file, m_offsets[i]);
+				m_okay &= BinaryFile::write_one(m_file, m_num_frames[i]);
+			}
+			m_okay &= BinaryFile::write_one(m_file, index_offset);
+		}
+		m_okay &= BinaryFile::close(m_file);
+		m_file = NULL;
+
+		m_manifest.close();
+		if (m_okay)
+			std::remove(m_manifest_filename.c_str());
+	}
+	return m_okay;
+}
+
+ResultStoreReader::ResultStoreReader(const std::string & filename, bool recover)
+	: m_file(NULL), m_complete(false)
+{
+	m_file = BinaryFile::open(filename, true);
+	if (!m_file)
+		return;
+
+	uint32_t num_videos = 0;
+	bool okay = read_header(m_file, num_videos, m_columns);
+	const long header_end = std::ftell(m_file);
+
+	// Read the index at the end of the file
+	uint64_t index_offset = 0;
+	bool complete = okay;
+	complete = complete && std::fseek(m_file, -long(sizeof(uint64_t)), SEEK_END) == 0;
+	complete = complete && BinaryFile::read_one(m_file, index_offset);
+	complete = complete && std::fseek(m_file, long(index_offset), SEEK_SET) == 0;
+	for (uint32_t i = 0; complete && i < num_videos; ++i)
+	{
+		uint64_t offset = 0;
+		uint32_t num_frames = 0;
+		complete &= BinaryFile::read_one(m_file, offset);
+		complete &= BinaryFile::read_one(m_file, num_frames);
+		complete &= offset < index_offset;
+		m_offsets.push_back(long(offset));
+		m_num_frames.push_back(num_frames);
+	}
+	m_complete = complete && m_offsets.size() == num_videos;
+
+	// The videos of an incomplete file that are listed in its manifest (in vid_id order) and whose data is complete
+	if (okay && !m_complete && recover)
+	{
+		okay = std::fseek(m_file, 0, SEEK_END) == 0;
+		const long file_size = std::ftell(m_file);
+		long row_size = 0;
+		for (const auto & column : m_columns)
+			row_size += column.width * column.value_size();
+
+		m_offsets.assign(num_videos, -1);
+		m_num_frames.assign(num_videos, 0);
+		std::ifstream manifest(filename + ".manifest");
+		long vid_id, end = header_end;
+		uint64_t offset;
+		uint32_t num_frames;
+		for (long next_vid_id = 0; manifest >> vid_id >> offset >> num_frames && vid_id == next_vid_id && vid_id < long(num_videos); ++next_vid_id)
+		{
+			if (long(offset) != end || end + num_frames * row_size > file_size)
+				break;
+			m_offsets[vid_id] = end;
+			m_num_frames[vid_id] = num_frames;
+			end += num_frames * row_size;
+		}
+	}
+	else
+		okay = m_complete;
+
+	// Corrupt files (and incomplete ones unless recovered) are not used at all
+	if (!okay)
+	{
+		BinaryFile::close(m_file);
+		m_file = NULL;
+		m_complete = false;
+		m_columns.clear();
+		m_offsets.clear();
+		m_num_frames.clear();
+	}
+}
+
+ResultStoreReader::~ResultStoreReader()
+{
+	if (m_file)
+		BinaryFile::close(m_file);
+}
+
+long ResultStoreReader::column(const std::string & name) const
+{
+	for (size_t i = 0; i < m_columns.size(); ++i)
+		if (m_columns[i].name == name)
+			return i;
+	return -1;
+}
+
+template <typename T>
+bool ResultStoreReader::read_column(long vid_id, size_t column, ResultColumn::Type type, std::vector<T> & values)
+{
+	if (!m_file || vid_id < 0 || vid_id >= num_videos() || !has_video(vid_id) || column >= m_columns.size() || m_columns[column].type != type)
+		return false;
+
+	// The columns of a video are stored one after the other
+	long offset = m_offsets[vid_id];
+	for (size_t i = 0; i < column; ++i)
+		offset += m_num_frames[vid_id] * m_columns[i].width * m_columns[i].value_size();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	values.resize(m_num_frames[vid_id] * m_columns[column].width);
+	if (std::fseek(m_file, offset, SEEK_SET) != 0)
+		return false;
+	return BinaryFile::read_n(m_file, values.data(), values.size());
+}
+
+bool ResultStoreReader::read(long vid_id, size_t column, std::vector<int16_t> & values)
+{
+	return read_column(vid_id, column, ResultColumn::INT16, values);
+}
+
+bool ResultStoreReader::read(long vid_id, size_t column, std::vector<int32_t> & values)
+{
+	return read_column(vid_id, column, ResultColumn::INT32, values);
+}
+
+bool ResultStoreReader::read(long vid_id, size_t column, std::vector<float> & values)
+{
+	return read_column(vid_id, column, ResultColumn::FLOAT32, values);
+}
+
+bool ResultStoreReader::read(long vid_id, ResultVideo & video)
+{
+	video = ResultVideo(m_columns);
+	std::vector<int16_t> int16_values;
+	std::vector<int32_t> int32_values;
+	std::vector<float> float_values;
+	for (size_t i = 0; i < m_columns.size(); ++i)
+	{
+		std::vector<char> & data = video.m_data[i];
+		bool okay = false;
+		switch (m_columns[i].type)
+		{
+		case ResultColumn::INT16:
+			okay = read(vid_id, i, int16_values);
+			data.assign(reinterpret_cast<const char *>(int16_values.data()), reinterpret_cast<const char *>(int16_values.data() + int16_values.size()));
+			break;
+		case ResultColumn::INT32:
+			okay = read(vid_id, i, int32_values);
+			data.assign(reinterpret_cast<const char *>(int32_values.data()), reinterpret_cast<const char *>(int32_values.data() + int32_values.size()));
+			break;
+		case ResultColumn::FLOAT32:
+			okay = read(vid_id, i, float_values);
+			data.assign(reinterpret_cast<const char *>(float_values.data()), reinterpret_cast<const char *>(float_values.data() + float_values.size()));
+			break;
+		}
+		if (!okay)
+			return false;
+	}
+	return true;
+}
+
+void read_face_detections(const std::string & filename, std::vector<std::vector<dlib::rectangle>> & detections)
+{
+	ResultStoreReader reader(filename);
+	DLIB_CASSERT(reader.is_open(), "Could not open filename: " << filename << " (or it is incomplete).\n");
+	const long column = reader.column("box");
+	DLIB_CASSERT(column >= 0, "No face detections in " << filename);
+
+	detections.clear();
+	detections.resize(reader.num_videos());
+	std::vector<int32_t> boxes;
+	for (long vid_id = 0; vid_id < reader.num_videos(); ++vid_id)
+	{
+		DLIB_CASSERT(reader.read(vid_id, column, boxes), "Error reading face detections of video " << vid_id << " from " << filename);
+		for (size_t i = 0; i + 3 < boxes.size(); i += 4)
+			detections[vid_id].push_back(dlib::rectangle(boxes[i], boxes[i + 1], boxes[i] + boxes[i + 2] - 1, boxes[i + 1] + boxes[i + 3] - 1));
+	}
+}
+
+bool export_result_csv(const std::string & store_filename, const std::string & csv_filename)
+{
+	ResultStoreReader reader(store_filename);
+	if (!reader.is_open())
+		return false;
+
+	std::ofstream file(csv_filename);
+	if (!file.is_open())
+		return false;
+
+	const std::vector<ResultColumn> & columns = reader.columns();
+	std::vector<std::vector<int16_t>> int16_values(columns.size());
+	std::vector<std::vector<int32_t>> int32_values(columns.size());
+	std::vector<std::vector<float>> float_values(columns.size());
+	for (long vid_id = 0; vid_id < reader.num_videos(); ++vid_id)
+	{
+		for (size_t i = 0; i < columns.size(); ++i)
+		{
+			bool okay = false;
+			switch (columns[i].type)
+			{
+			case ResultColumn::INT16: okay = reader.read(vid_id, i, int16_values[i]); break;
+			case ResultColumn::INT32: okay = reader.read(vid_id, i, int32_values[i]); break;
+			case ResultColumn::FLOAT32: okay = reader.read(vid_id, i, float_values[i]); break;
+			}
+			if (!okay)
+				return false;
+		}
+
+		// Same number formatting as the former text output (operator<< of the stream)
+		for (long frame_no = 0; frame_no < reader.num_frames(vid_id); ++frame_no)
+		{
+			file << vid_id << "," << frame_no;
+			for (size_t i = 0; i < columns.size(); ++i)
+			{
+				for (long j = frame_no * columns[i].width; j < (frame_no + 1) * columns[i].width; ++j)
+				{
+					switch (columns[i].type)
+					{
+					case ResultColumn::INT16: file << "," << int16_values[i][j]; break;
+					case ResultColumn::INT32: file << "," << int32_values[i][j]; break;
+					case ResultColumn::FLOAT32: file << "," << float_values[i][j]; break;
+					}
+				}
+			}
+			file << "\n";
+		}
+	}
+
+	file.close();
+	return !file.fail();
+}
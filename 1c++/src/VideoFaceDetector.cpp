@@ -0,0 +1,109 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+#include <FaceBase/VideoFaceDetector.hpp>
+#include <algorithm>
+#include <cmath>
+
+VideoFaceDetector::VideoFaceDetector(const FaceDetectorDlib & detector, long keyframe_interval, double min_tracking_confidence, double roi_scale)
+	: m_detector(detector), m_keyframe_interval(keyframe_interval), m_min_tracking_confidence(min_tracking_confidence), m_roi_scale(roi_scale)
+{
+	reset();
+}
+
+void VideoFaceDetector::reset()
+{
+	m_tracking = false;
+	m_last_face = dlib::rectangle();
+	m_frames_since_detection = 0;
+	m_num_detector_frames = 0;
+	m_num_tracked_frames = 0;
+	m_num_roi_frames = 0;
+}
+
+void VideoFaceDetector::detect(const std::vector<image_type> & images, std::vector<dlib::rectangle> & faces)
+{
+	faces.resize(images.size());
+
+	// Full frame detection only: Process the whole batch at once
+	if (m_keyframe_interval <= 1 && m_roi_scale <= 0)
+	{
+		m_detector.detect(images, m_detection_list);
+		for (size_t i = 0; i < images.size(); ++i)
+			faces[i] = best_detection(m_detection_list[i]);
+		m_num_detector_frames += images.size();
+		return;
+	}
+
+	// Tracking and ROI detection depend on the previous frame: Frames have to be processed one after another
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		bool run_detector = !m_tracking || m_frames_since_detection >= m_keyframe_interval;
+		if (!run_detector)
+		{
+			double confidence = m_tracker.update(images[i]);
+			if (confidence < m_min_tracking_confidence)
+			{
+				// Tracker drifted, re-detect
+				run_detector = true;
+			}
+			else
+			{
+				const dlib::drectangle pos = m_tracker.get_position();
+				faces[i] = dlib::rectangle(std::lround(pos.left()), std::lround(pos.top()), std::lround(pos.right()), std::lround(pos.bottom()));
+				++m_frames_since_detection;
+				++m_num_tracked_frames;
+			}
+		}
+
+		if (run_detector)
+		{
+			faces[i] = detect_single(images[i]);
+			m_tracking = m_keyframe_interval > 1 && !faces[i].is_empty();
+			if (m_tracking)
+				m_tracker.start_track(images[i], faces[i]);
+			m_frames_since_detection = 1;
+		}
+		m_last_face = faces[i];
+	}
+}
+
+dlib::rectangle VideoFaceDetector::detect_single(const image_type & img)
+{
+	++m_num_detector_frames;
+
+	// Search enlarged region around the previous face first
+	if (m_roi_scale > 0 && !m_last_face.is_empty())
+	{
+		const dlib::rectangle roi = dlib::get_rect(img).intersect(dlib::centered_rect(m_last_face,
+			static_cast<unsigned long>(m_last_face.width() * m_roi_scale), static_cast<unsigned long>(m_last_face.height() * m_roi_scale)));
+		if (!roi.is_empty())
+		{
+			m_roi_image = dlib::subm(img, roi);
+			std::vector<dlib::mmod_rect> dets;
+			m_detector.detect(m_roi_image, dets);
+			if (!dets.empty())
+			{
+				++m_num_roi_frames;
+				// Map from ROI to full frame coordinates
+				return dlib::translate_rect(best_detection(dets), roi.tl_corner());
+			}
+		}
+	}
+
+	// Search full frame
+	std::vector<dlib::mmod_rect> dets;
+	m_detector.detect(img, dets);
+	return best_detection(dets);
+}
+
+dlib::rectangle VideoFaceDetector::best_detection(std::vector<dlib::mmod_rect> & dets)
+{
+	if (dets.empty())
+		return dlib::rectangle();
+
+	// Sort detection scores in ascending order
+	std::sort(dets.begin(), dets.end(), [](const dlib::mmod_rect& left, const dlib::mmod_rect& right) {return(right.detection_confidence < left.detection_confidence); });
+	// The first detection has the highest score.
+	return dets.at(0).rect;
+}
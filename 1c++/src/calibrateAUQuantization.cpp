@@ -0,0 +1,194 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+/* Compares the quantized AU estimation (see AUIntensityEstimation::set_quantization()) with the float model on a sample
+ * video set and prints the maximum and mean absolute deviation of the AU intensities for 16 and 8 bit weights.
+ * The faces are registered exactly as in detectAUsOld(), using its face detections and (if available) landmarks.
+ */
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include <dlib/image_processing.h>
+#include <dlib/opencv.h>
+
+#include <FaceBase/FaceRegistrationAffineMeanShape.hpp>
+#include <FaceBase/FaceLibDlib.hpp>
+
+#include <ActionUnitIntensityEstimation/AU.hpp>
+
+#include "misc.hpp"
+#include "LandmarkCache.hpp"
+#include "ResultStore.hpp"
+#include "ExtractionOptions.hpp"
+#include "ExtractionModels.hpp"
+
+using namespace dlib;
+using namespace std;
+
+namespace {
+
+// Absolute deviations of the AU intensities of one quantized model from the float model
+struct AUDeviation
+{
+	std::vector<double> max_abs;
+	std::vector<double> sum_abs;
+	long num_frames = 0;
+
+	void add(const cv::Mat& AUs, const cv::Mat& AUs_float)
+	{
+		max_abs.resize(AUs.cols, 0.0);
+		sum_abs.resize(AUs.cols, 0.0);
+		for(int au = 0; au < AUs.cols; ++au)
+		{
+			const double d = std::abs(static_cast<double>(AUs.at<float>(au)) - AUs_float.at<float>(au));
+			max_abs[au] = std::max(max_abs[au], d);
+			sum_abs[au] += d;
+		}
+		++num_frames;
+	}
+
+	void merge(const AUDeviation& other)
+	{
+		max_abs.resize(std::max(max_abs.size(), other.max_abs.size()), 0.0);
+		sum_abs.resize(max_abs.size(), 0.0);
+		for(size_t au = 0; au < other.max_abs.size(); ++au)
+		{
+			max_abs[au] = std::max(max_abs[au], other.max_abs[au]);
+			sum_abs[au] += other.sum_abs[au];
+		}
+		num_frames += other.num_frames;
+	}
+};
+
+}
+
+void calibrateAUQuantization(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options)
+{
+	std::string filename_list_filename = exdata_dir + train_or_val_or_test + "_filenames.txt";
+	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.bin";
+	std::string filename_landmarks = exdata_dir + train_or_val_or_test + "_landmarks.bin";
+
+	std::string shape_predictor_file = exdata_dir + "spd+all=cascade30+oversampling70+trees1500.dat";
+	std::string mean_shape_file = exdata_dir + "mean_face_shape_intraface.dat";
+
+	std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> filename_list;
+	misc::read_filename_list(filename_list_filename, filename_list);
+
+	std::vector<std::vector<dlib::rectangle>> face_dets_list;
+	read_face_detections(filename_face_detection, face_dets_list);
+
+	DLIB_CASSERT(filename_list.size() == face_dets_list.size(), "List size mismatch: \n\t filename_list.size(): " << filename_list.size() << "\n\t face_dets_list.size(): " << face_dets_list.size() << std::endl);
+
+	shape_predictor sp;
+	deserialize(shape_predictor_file) >> sp;
+
+	FaceRegistrationAffineMeanShape face_reg;
+	DLIB_CASSERT(face_reg.init(mean_shape_file.c_str(), cv::Size(200, 200), 0.5),  "Error loading/initializing the face registration model: " << mean_shape_file);
+	face_reg.set_closed_form(!options.affine_svd);
+
+	// Float reference model and both quantized models
+	AUIntensityEstimation AU_float;
+	loadAUModel(exdata_dir, AU_float);
+	AU_float.set_fold_normalization(!options.au_unfolded);
+	AUIntensityEstimation AU_int16 = AU_float;
+	DLIB_CASSERT(AU_int16.set_quantization(AUIntensityEstimation::QUANTIZATION_INT16), "Error quantizing the AU model.");
+	AUIntensityEstimation AU_int8 = AU_float;
+	DLIB_CASSERT(AU_int8.set_quantization(AUIntensityEstimation::QUANTIZATION_INT8), "Error quantizing the AU model.");
+
+	// Use the landmarks saved by detectAUsOld() instead of running the shape predictor again (if available and valid)
+	LandmarkCacheReader landmark_reader(filename_landmarks);
+	const bool use_landmark_cache = landmark_reader.is_open() && landmark_reader.num_videos() == filename_list.size() && landmark_reader.num_points() == sp.num_parts();
+	if (use_landmark_cache)
+		std::cout << "Using landmarks from " << filename_landmarks << std::endl;
+	else
+		std::cout << "No valid landmark file " << filename_landmarks << " found. Detecting landmarks ..." << std::endl;
+
+	// One copy of each model per thread
+	const long num_jobs = std::max(options.jobs, 1L);
+	std::vector<shape_predictor> sps(num_jobs, sp);
+	std::vector<FaceRegistrationAffineMeanShape> face_regs(num_jobs, face_reg);
+	std::vector<AUIntensityEstimation::Workspace> AU_workspaces(num_jobs);
+	for (long job_id = 0; job_id < num_jobs; ++job_id)
+		AU_float.init_workspace(AU_workspaces[job_id], cv::Size(200, 200));
+	std::vector<AUDeviation> deviations_int16(num_jobs), deviations_int8(num_jobs);
+
+	misc::parallel_for_videos(options.jobs, filename_list.size(), [&](long job_id, long vid_id)
+	{
+	      const auto vid_filename = filename_list.at(vid_id);
+	      shape_predictor& sp = sps.at(job_id);
+	      FaceRegistrationAffineMeanShape& face_reg = face_regs.at(job_id);
+	      AUIntensityEstimation::Workspace& AU_workspace = AU_workspaces.at(job_id);
+
+	      matrix<rgb_pixel> img;
+	      cv::Mat cvImage, face_registered, AUs_float, AUs_int16, AUs_int8;
+	      std::vector<cv::Point2f> landmarks68, landmarks49, landmarks49_registered;
+
+	      misc::print_progress(time_start, vid_id, filename_list.size(), vid_filename);
+
+	      cv::VideoCapture vid(vid_filename);
+	      DLIB_CASSERT(vid.isOpened(), "Cannot open video filename : " << vid_filename);
+
+	      const std::vector<dlib::rectangle>& face_dets = face_dets_list.at(vid_id);
+	      std::vector<int16_t> video_landmarks;
+	      const bool video_landmarks_cached = use_landmark_cache && landmark_reader.num_frames(vid_id) == face_dets.size() && landmark_reader.read(vid_id, video_landmarks);
+
+	      long frame_no = 0;
+	      while (vid.read(cvImage) && frame_no < static_cast<long>(face_dets.size()))
+	      {
+		      const auto& face_det = face_dets.at(frame_no);
+
+		      // Get landmarks
+		      if (!video_landmarks_cached)
+			      dlib::assign_image(img, dlib::cv_image<dlib::bgr_pixel>(cvImage));
+		      dlib::full_object_detection shape = video_landmarks_cached ? landmark_reader.get_shape(video_landmarks, frame_no, face_det) : sp(img, face_det);
+		      landmarks68.clear();
+		      for (long part_no = 0; part_no < shape.num_parts(); ++part_no)
+			      landmarks68.push_back(cv::Point2f(shape.part(part_no).x(), shape.part(part_no).y()));
+		      FaceLibDlib::conv_landmarks_68_to_49(landmarks68, landmarks49);
+
+		      // Register face and estimate AU intensities with all models
+		      if (options.gray_warp)
+			      face_reg.register_face_gray(landmarks49, cvImage, face_registered, &landmarks49_registered);
+		      else
+			      face_reg.register_face(landmarks49, cvImage, &face_registered, &landmarks49_registered);
+		      DLIB_CASSERT(AU_float.estimate(face_registered, landmarks49_registered, AUs_float, AU_workspace), "AU estimation failed in video " << vid_filename);
+		      DLIB_CASSERT(AU_int16.estimate(face_registered, landmarks49_registered, AUs_int16, AU_workspace), "AU estimation failed in video " << vid_filename);
+		      DLIB_CASSERT(AU_int8.estimate(face_registered, landmarks49_registered, AUs_int8, AU_workspace), "AU estimation failed in video " << vid_filename);
+
+		      deviations_int16.at(job_id).add(AUs_int16, AUs_float);
+		      deviations_int8.at(job_id).add(AUs_int8, AUs_float);
+
+		      ++frame_no;
+	      }
+	});
+
+	AUDeviation deviation_int16, deviation_int8;
+	for (long job_id = 0; job_id < num_jobs; ++job_id)
+	{
+		deviation_int16.merge(deviations_int16[job_id]);
+		deviation_int8.merge(deviations_int8[job_id]);
+	}
+
+	// Print table of the deviations from the float model per AU
+	const long num_frames = std::max(deviation_int16.num_frames, 1L);
+	const cv::Mat AUIds = AU_float.get_AUIds();
+	std::cout << "Absolute deviation of the quantized from the float AU intensities (" << deviation_int16.num_frames << " frames):" << std::endl;
+	std::cout << std::setw(6) << "AU" << std::setw(14) << "int16 max" << std::setw(14) << "int16 mean" << std::setw(14) << "int8 max" << std::setw(14) << "int8 mean" << std::endl;
+	for (size_t au = 0; au < deviation_int16.max_abs.size(); ++au)
+	{
+		std::cout << std::setw(6) << AUIds.at<int>(static_cast<int>(au))
+			<< std::setw(14) << deviation_int16.max_abs[au] << std::setw(14) << deviation_int16.sum_abs[au] / num_frames
+			<< std::setw(14) << deviation_int8.max_abs[au] << std::setw(14) << deviation_int8.sum_abs[au] / num_frames << std::endl;
+	}
+}
@@ -7,7 +7,10 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include <iostream>
+#include <sstream>
 #include <chrono>
+#include <algorithm>
+#include <experimental/filesystem>
 
 #include <dlib/image_processing.h>
 #include <dlib/opencv.h>
@@ -18,22 +21,71 @@
 #include <ActionUnitIntensityEstimation/AU.hpp>
 
 #include "misc.hpp"
+#include "LandmarkCache.hpp"
+#include "ResultStore.hpp"
+#include "Checkpoint.hpp"
+#include "ExtractionOptions.hpp"
+#include "ExtractionModels.hpp"
+#include "Profiler.hpp"
 
 using namespace dlib;
 using namespace std;
 
-void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val_or_test)
+namespace fs = std::experimental::filesystem;
+
+/* Loads the AU model from the binary model file in exdata_dir, which is much faster than parsing the text files.
+ * If the binary file does not exist or is older than the text files, the text files are loaded and converted.
+ */
+void loadAUModel(const std::string& exdata_dir, AUIntensityEstimation& AU)
+{
+	std::string feature_model_file = exdata_dir + "lbp_10_10_8_1.txt";
+	std::string mean_std_file = exdata_dir + "Features_mean_std_disfa.txt";
+	std::string regressor_file = exdata_dir + "Regression_model_disfa_1_2_4_6_9_12_25.txt";
+	std::string binary_model_file = exdata_dir + "AU_model_disfa_1_2_4_6_9_12_25.bin";
+
+	std::error_code ec;
+	const auto binary_time = fs::last_write_time(binary_model_file, ec);
+	bool up_to_date = !ec;
+	for(const auto& text_file : {feature_model_file, mean_std_file, regressor_file})
+	{
+		const auto text_time = fs::last_write_time(text_file, ec);
+		up_to_date = up_to_date && (ec || text_time <= binary_time);
+	}
+
+	if(up_to_date && AU.init(binary_model_file))
+		return;
+
+	DLIB_CASSERT(AU.init(feature_model_file, mean_std_file, regressor_file), "Error loading AU model.");
+	if(AU.save(binary_model_file))
+		std::cout << "Converted AU model to " << binary_model_file << std::endl;
+	else
+		std::cout << "Warning: Could not write " << binary_model_file << std::endl;
+}
+
+// Applies the AU estimation settings of the command line options to a loaded model
+void configureAUModel(const ExtractionOptions& options, AUIntensityEstimation& AU)
+{
+	AU.set_fold_normalization(!options.au_unfolded);
+	DLIB_CASSERT(!options.au_unfolded || options.au_quantization == "none", "The quantized AU model cannot be combined with the unfolded normalization.");
+	if(options.au_quantization == "int16")
+		DLIB_CASSERT(AU.set_quantization(AUIntensityEstimation::QUANTIZATION_INT16), "Error quantizing the AU model.");
+	else if(options.au_quantization == "int8")
+		DLIB_CASSERT(AU.set_quantization(AUIntensityEstimation::QUANTIZATION_INT8), "Error quantizing the AU model.");
+}
+
+void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options)
 {
 	std::string filename_list_filename = exdata_dir + train_or_val_or_test + "_filenames.txt";
-	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.txt";
-	std::string filename_AUsOld = exdata_dir + train_or_val_or_test + "_AUOld.txt";
+	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.bin";
+	std::string filename_AUsOld = exdata_dir + train_or_val_or_test + "_AUOld.bin";
+	std::string filename_landmarks = exdata_dir + train_or_val_or_test + "_landmarks.bin";
+	std::string filename_checkpoint = exdata_dir + train_or_val_or_test + "_AUOld.checkpoint";
 	
 	std::string shape_predictor_file = exdata_dir + "spd+all=cascade30+oversampling70+trees1500.dat";
 	std::string mean_shape_file = exdata_dir + "mean_face_shape_intraface.dat";
-	std::string feature_model_file = exdata_dir + "lbp_10_10_8_1.txt";
-	std::string mean_std_file = exdata_dir + "Features_mean_std_disfa.txt";
-	std::string regressor_file = exdata_dir + "Regression_model_disfa_1_2_4_6_9_12_25.txt";
 
+	// Number of frames whose AU intensities are estimated at once
+	const size_t au_batch_size = 32;
 	 
 	std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
 
@@ -43,16 +95,32 @@ void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val
 
 	
 	std::vector<std::vector<dlib::rectangle>> face_dets_list;
-	misc::read_face_detection(filename_face_detection, face_dets_list);
-
-	
-	using t_AUs = std::vector<float>;
-	using t_AU_vid = std::vector<t_AUs>;
-	using t_AU_vids = std::vector<t_AU_vid>;
-	t_AU_vids au_vids;
+	read_face_detections(filename_face_detection, face_dets_list);
 
 	DLIB_CASSERT(filename_list.size() == face_dets_list.size(), "List size mismatch: \n\t filename_list.size(): " << filename_list.size() << "\n\t face_dets_list.size(): " << face_dets_list.size() << std::endl);
-	
+
+	AUIntensityEstimation AU;
+	loadAUModel(exdata_dir, AU);
+	configureAUModel(options, AU);
+	const std::vector<ResultColumn> AU_columns = au_columns(AU.get_AUIds().total());
+
+	// Videos whose file, face detections, models, and settings did not change since the last run are not processed again
+	std::ostringstream models_key;
+	models_key << Checkpoint::content_key(shape_predictor_file) << ":" << Checkpoint::content_key(mean_shape_file);
+	for(const std::string model_file : {"lbp_10_10_8_1.txt", "Features_mean_std_disfa.txt", "Regression_model_disfa_1_2_4_6_9_12_25.txt"})
+		models_key << ":" << Checkpoint::content_key(exdata_dir + model_file);
+	models_key << ":" << options.affine_svd << options.gray_warp << options.au_unfolded << ":" << options.au_quantization;
+	Checkpoint checkpoint(filename_checkpoint, models_key.str(), !options.recompute);
+	const std::vector<std::string> video_keys = video_input_keys(filename_list, &face_dets_list);
+	std::vector<ResultVideo> previous_AUs;
+	std::vector<bool> reused;
+	if (read_reused_results(checkpoint, video_keys, filename_AUsOld, AU_columns, previous_AUs, reused))
+	{
+		std::cout << "All videos are unchanged since the last run (see " << filename_checkpoint << "), skipping AU estimation." << std::endl;
+		return;
+	}
+	std::cout << std::count(reused.begin(), reused.end(), true) << " of " << filename_list.size() << " videos are unchanged since the last run." << std::endl;
+	DLIB_CASSERT(checkpoint.start(video_keys, reused), "Could not write " << filename_checkpoint);
 
 	shape_predictor sp;
 	deserialize(shape_predictor_file) >> sp;
@@ -60,45 +128,95 @@ void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val
 	
 	FaceRegistrationAffineMeanShape face_reg;
 	DLIB_CASSERT(face_reg.init(mean_shape_file.c_str(), cv::Size(200, 200), 0.5),  "Error loading/initializing the face registration model: " << mean_shape_file);
+	face_reg.set_closed_form(!options.affine_svd);
 
-	AUIntensityEstimation AU(feature_model_file, mean_std_file, regressor_file);
-	DLIB_CASSERT(AU.is_initialized(), "Error loading AU model.");
+	// One copy of each model per thread
+	const long num_jobs = std::max(options.jobs, 1L);
+	std::vector<shape_predictor> sps(num_jobs, sp);
+	std::vector<FaceRegistrationAffineMeanShape> face_regs(num_jobs, face_reg);
+	std::vector<AUIntensityEstimation> AUs(num_jobs, AU);
+	std::vector<AUIntensityEstimation::Workspace> AU_workspaces(num_jobs);
+	for (long job_id = 0; job_id < num_jobs; ++job_id)
+		AU.init_workspace(AU_workspaces[job_id], cv::Size(200, 200), static_cast<int>(au_batch_size));
 
-	
+	// AU intensities are written video by video
+	ResultStoreWriter AU_writer(filename_AUsOld, filename_list.size(), AU_columns);
+	DLIB_CASSERT(AU_writer.is_open(), "Could not open filename: " << filename_AUsOld << " for writing.\n");
 
-	matrix<rgb_pixel> img;
-	cv::Mat cvImage, face_registered, AU_detections;
-	std::vector<cv::Point2f> landmarks68, landmarks49, landmarks49_registered;
-	std::vector<int> AU_IDs; // Empty vector -> All AUs are going to become visualized
-	cv::Rect bbox;
-	t_AUs au;
-	t_AU_vid AU_vid;
+	// Landmarks are saved for the later stages, so they do not need to run the shape predictor again
+	LandmarkCacheWriter landmark_writer(filename_landmarks, filename_list.size(), sp.num_parts());
+	DLIB_CASSERT(landmark_writer.is_open(), "Could not open filename: " << filename_landmarks << " for writing.\n");
 
-	for(long vid_id = 0; vid_id < filename_list.size(); ++vid_id)
+	misc::parallel_for_videos(options.jobs, filename_list.size(), [&](long job_id, long vid_id)
 	{
+	      // The landmarks of reused videos are not kept, later stages run the shape predictor for them if needed
+	      if (reused[vid_id])
+	      {
+		      landmark_writer.write(vid_id, std::vector<int16_t>());
+		      AU_writer.write(vid_id, std::move(previous_AUs[vid_id]));
+		      return;
+	      }
+
+	      profiler::VideoScope video_scope(vid_id);
 	      const auto vid_filename = filename_list.at(vid_id);
-	      
-	      std::chrono::steady_clock::time_point time_end = std::chrono::steady_clock::now();
-	      int seconds_expired = std::chrono::duration_cast<std::chrono::seconds>(time_end - time_start).count();
-	      int minutes_left = vid_id == 0 ? 0 : seconds_expired * (static_cast<double>(filename_list.size() - vid_id) / (double)vid_id / 60.0);
-	      std::cout << rpad(cast_to_string(vid_id+1),3) << "/" << filename_list.size() << ". Approx. " << rpad(cast_to_string(minutes_left), 3) << " minutes left. " << "Processing video: " << vid_filename << std::endl;
+	      shape_predictor& sp = sps.at(job_id);
+	      FaceRegistrationAffineMeanShape& face_reg = face_regs.at(job_id);
+	      AUIntensityEstimation& AU = AUs.at(job_id);
+	      AUIntensityEstimation::Workspace& AU_workspace = AU_workspaces.at(job_id);
+
+	      matrix<rgb_pixel> img;
+	      cv::Mat cvImage, AU_detections;
+	      std::vector<cv::Point2f> landmarks68, landmarks49;
+	      std::vector<cv::Mat> faces_registered(au_batch_size);
+	      std::vector<std::vector<cv::Point2f>> landmarks49_registered(au_batch_size);
+	      size_t batch_size = 0;
+	      std::vector<int> AU_IDs; // Empty vector -> All AUs are going to become visualized
+	      cv::Rect bbox;
+	      ResultVideo AU_video(AU_columns);
+	      std::vector<int16_t> video_landmarks;
+
+	      // Estimate AU intensities of the collected registered faces
+	      auto estimate_AUs = [&]()
+	      {
+		      faces_registered.resize(batch_size);
+		      landmarks49_registered.resize(batch_size);
+		      DLIB_CASSERT(AU.estimate_batch(faces_registered, landmarks49_registered, AU_detections, AU_workspace), "AU estimation failed in video " << vid_filename);
+
+		      DLIB_CASSERT(AU_detections.cols == AU_columns[0].width, "Unexpected number of AUs in video " << vid_filename);
+		      for(int row = 0; row < AU_detections.rows; ++row)
+			      AU_video.append(0, AU_detections.ptr<float>(row));
+		      batch_size = 0;
+	      };
+
+	      misc::print_progress(time_start, vid_id, filename_list.size(), vid_filename);
 	  
 	      cv::VideoCapture vid(vid_filename);
 	      DLIB_CASSERT(vid.isOpened(), "Cannot open video filename : " << vid_filename);
 	      
 	      const std::vector<dlib::rectangle>& face_dets = face_dets_list.at(vid_id);
 	      
-	      long frame_no = 0;
-	      AU_vid.clear();
-	      while (vid.read(cvImage))
+	      auto read_frame = [&]() -> bool
 	      {
+		      profiler::Timer timer("decode");
+		      if (!vid.read(cvImage))
+			      return false;
 		      // Prepare for next frame
 		      dlib::assign_image(img, dlib::cv_image<dlib::bgr_pixel>(cvImage));
+		      profiler::add_frames(1);
+		      return true;
+	      };
+
+	      long frame_no = 0;
+	      while (read_frame())
+	      {
 
 		      const auto& face_det = face_dets.at(frame_no);
 		      
 		      // Get landmarks
+		      profiler::Timer sp_timer("shape_predictor");
 		      dlib::full_object_detection shape = sp(img, face_det);
+		      sp_timer.stop();
+		      LandmarkCacheWriter::append(shape, video_landmarks);
 		      matrix<rgb_pixel> face_chip;
 		      // 1. From dlib to opencv
 		      landmarks68.clear();
@@ -108,43 +226,38 @@ void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val
 		      FaceLibDlib::conv_landmarks_68_to_49(landmarks68, landmarks49);
 
 		      // Register face
-		      face_reg.register_face(landmarks49, cvImage, &face_registered, &landmarks49_registered);
+		      profiler::Timer reg_timer("register_face");
+		      if (options.gray_warp)
+			      face_reg.register_face_gray(landmarks49, cvImage, faces_registered[batch_size], &landmarks49_registered[batch_size]);
+		      else
+			      face_reg.register_face(landmarks49, cvImage, &faces_registered[batch_size], &landmarks49_registered[batch_size]);
+		      reg_timer.stop();
 
-		      // Estimate AU Intensity
-		      AU.estimate(face_registered, landmarks49_registered, AU_detections);
+		      // Estimate AU Intensity (in batches)
+		      if(++batch_size == au_batch_size)
+			      estimate_AUs();
 
 		      // Visualize AUs
 		      // 1. Convert bounding box into opencv format
 		      //bbox = cv::Rect(std::max(face_det.left(),(long)0), std::max(face_det.top(),(long)0), face_det.width(), face_det.height());
 		      //AU.visualize(cvImage, landmarks49, AU_detections, AU_IDs, bbox);
-		      
-		      au.clear();
-		      for(int auIdx = 0; auIdx < AU_detections.cols; ++auIdx)
-			  au.push_back(AU_detections.at<float>(auIdx));
-		      AU_vid.push_back(au);
   
 		      ++frame_no;
 		      //cv::imshow("frame", cvImage);
 
 	      }
-	      au_vids.push_back(AU_vid);
-	}
-	
-	
-	// Save AUs to file
-	DLIB_CASSERT(au_vids.size() == filename_list.size(), "au_vids.size() != filename_list.size(). \n\t au_vids.size(): " << au_vids.size() << "\n\t filename_list.size(): " << filename_list.size() << std::endl);
-	// Open AU filename
-	std::ofstream AUFile(filename_AUsOld);
-	DLIB_CASSERT(AUFile.is_open());
-	for(long vid_id = 0; vid_id < au_vids.size(); ++vid_id)
-	    for(long frame_no = 0; frame_no < au_vids.at(vid_id).size(); ++frame_no)
-	    {
-		    AUFile << vid_id << "," << frame_no;
-		    for(int auIdx = 0; auIdx < au_vids.at(vid_id).at(frame_no).size(); ++auIdx)
-			AUFile << "," << au_vids[vid_id][frame_no][auIdx];
-		    AUFile << "\n";
-	    }
-	AUFile.close();
+	      if(batch_size > 0)
+		      estimate_AUs();
+	      // Never waits: the results are written in video order, so they are only buffered while earlier videos are missing.
+	      // If this video closes the gap, the time includes writing its results and the buffered results of later videos.
+	      profiler::Timer write_timer("write");
+	      landmark_writer.write(vid_id, std::move(video_landmarks));
+	      AU_writer.write(vid_id, std::move(AU_video));
+	      write_timer.stop();
+	      checkpoint.set_done(vid_id, video_keys[vid_id]);
+	});
+	DLIB_CASSERT(landmark_writer.close(), "Error writing landmarks to " << filename_landmarks);
+	DLIB_CASSERT(AU_writer.close(), "Error writing AUs to " << filename_AUsOld);
 	
 	return;
 }
@@ -13,94 +13,166 @@
 #include <fstream>
 #include <string>
 #include <chrono>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <memory>
+#include <FaceBase/FaceDetectorDlibCNN.hpp>
+#include <FaceBase/FaceDetectorDlibHOG.hpp>
+#include <FaceBase/VideoFaceDetector.hpp>
 #include "misc.hpp"
+#include "ResultStore.hpp"
+#include "Checkpoint.hpp"
+#include "AsyncVideoDecoder.hpp"
+#include "ExtractionOptions.hpp"
+#include "ExtractionModels.hpp"
+#include "Profiler.hpp"
 
 //using namespace std;
 using namespace dlib;
 
-// ----------------------------------------------------------------------------------------
-
-template <long num_filters, typename SUBNET> using con5d = con<num_filters, 5, 5, 2, 2, SUBNET>;
-template <long num_filters, typename SUBNET> using con5 = con<num_filters, 5, 5, 1, 1, SUBNET>;
-
-template <typename SUBNET> using downsampler = relu<affine<con5d<32, relu<affine<con5d<32, relu<affine<con5d<16, SUBNET>>>>>>>>>;
-template <typename SUBNET> using rcon5 = relu<affine<con5<45, SUBNET>>>;
-
-using net_type = loss_mmod<con<1, 9, 9, 1, 1, rcon5<rcon5<rcon5<downsampler<input_rgb_image_pyramid<pyramid_down<6>>>>>>>>;
+// Create and load the face detector backend selected by name ("cnn" or "hog")
+cv::Ptr<FaceDetectorDlib> createFaceDetector(const std::string& name, const std::string& exdata_dir)
+{
+	cv::Ptr<FaceDetectorDlib> detector;
+	std::string model_filename;
+	if (name == "cnn")
+	{
+		detector = cv::Ptr<FaceDetectorDlib>(new FaceDetectorDlibCNN());
+		model_filename = exdata_dir + "mmod_human_face_detector.dat";
+	}
+	else if (name == "hog")
+		detector = cv::Ptr<FaceDetectorDlib>(new FaceDetectorDlibHOG());
+	DLIB_CASSERT(!detector.empty(), "Unknown face detector: " << name);
+	DLIB_CASSERT(detector->load(model_filename.c_str()), "Error loading face detector model: " << model_filename);
+	return detector;
+}
 
-void detectFace(const std::string& exdata_dir, const std::string& train_or_val_or_test)
+void detectFace(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options)
 {
 	std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
 
 	std::string filename_list_filename = exdata_dir + train_or_val_or_test + "_filenames.txt";
-	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.txt";
-	std::string net_filename = exdata_dir + "mmod_human_face_detector.dat";
+	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.bin";
+	std::string filename_checkpoint = exdata_dir + train_or_val_or_test + "_facedet.checkpoint";
 
 	
 	
 	std::vector<std::string> filename_list;
 	misc::read_filename_list(filename_list_filename, filename_list);
 
-	net_type net;
-	deserialize(net_filename) >> net;
-	long nrVid = 0;
-	long nrError = 0;
+	const size_t batch_size = 15;
+
+	// Videos whose file, detector, and detection settings did not change since the last run are not processed again
+	std::ostringstream models_key;
+	models_key << options.detector << ":" << (options.detector == "cnn" ? Checkpoint::content_key(exdata_dir + "mmod_human_face_detector.dat") : "-")
+		   << ":" << options.keyframe_interval << ":" << options.min_tracking_confidence << ":" << options.roi_scale;
+	Checkpoint checkpoint(filename_checkpoint, models_key.str(), !options.recompute);
+	const std::vector<std::string> video_keys = video_input_keys(filename_list);
+	std::vector<ResultVideo> previous_detections;
+	std::vector<bool> reused;
+	if (read_reused_results(checkpoint, video_keys, filename_face_detection, face_detection_columns(), previous_detections, reused))
+	{
+		std::cout << "All videos are unchanged since the last run (see " << filename_checkpoint << "), skipping face detection." << std::endl;
+		return;
+	}
+	std::cout << std::count(reused.begin(), reused.end(), true) << " of " << filename_list.size() << " videos are unchanged since the last run." << std::endl;
+	CV_Assert(checkpoint.start(video_keys, reused));
+
+	std::atomic<long> nrError(0);
+	std::atomic<long> nrFrames(0), nrDetectorFrames(0), nrTrackedFrames(0), nrRoiFrames(0);
+	std::atomic<long long> detectionMicroseconds(0);
+
+	// One detector per thread
+	std::vector<cv::Ptr<FaceDetectorDlib>> detectors(1, createFaceDetector(options.detector, exdata_dir));
+	for (long job_id = 1; job_id < options.jobs; ++job_id)
+		detectors.push_back(detectors[0]->clone());
 
 	// Open detection filename
-	std::ofstream detFile(filename_face_detection);
-	CV_Assert(detFile.is_open());
+	ResultStoreWriter detWriter(filename_face_detection, filename_list.size(), face_detection_columns());
+	CV_Assert(detWriter.is_open());
 	
-	for(const auto& filename : filename_list)
+	misc::parallel_for_videos(options.jobs, filename_list.size(), [&](long job_id, long nrVid)
 	{
+		if (reused[nrVid])
+		{
+			detWriter.write(nrVid, std::move(previous_detections[nrVid]));
+			return;
+		}
+
+		const auto& filename = filename_list.at(nrVid);
+		const FaceDetectorDlib& detector = *detectors.at(job_id);
+		ResultVideo detVideo(face_detection_columns());
+		bool failed = false;
+		profiler::VideoScope video_scope(nrVid);
 		try
 		{
-		    std::chrono::steady_clock::time_point time_end = std::chrono::steady_clock::now();
-		    int seconds_expired = std::chrono::duration_cast<std::chrono::seconds>(time_end - time_start).count();
-		    int minutes_left = nrVid == 0 ? 0 : seconds_expired * (static_cast<double>(filename_list.size() - nrVid) / (double)nrVid / 60.0);
+		    misc::print_progress(time_start, nrVid, filename_list.size(), filename);
 
-		    // Open video
-		    std::cout << rpad(cast_to_string(nrVid+1),3) << "/" << filename_list.size() << ". Approx. " << rpad(cast_to_string(minutes_left), 3) << " minutes left. " << "Processing video: " << filename;
-		    cv::VideoCapture vid(filename);
-		    CV_Assert(vid.isOpened());
+		    // Open video. Decode either in a separate thread or synchronously before each detection batch
+		    std::unique_ptr<AsyncVideoDecoder> decoder;
+		    cv::VideoCapture vid;
+		    if (options.async_decode)
+		    {
+			    decoder.reset(new AsyncVideoDecoder(filename));
+			    CV_Assert(decoder->is_opened());
+		    }
+		    else
+		    {
+			    vid.open(filename);
+			    CV_Assert(vid.isOpened());
+		    }
 
 		    cv::Mat cvBGRImg;
-		    dlib::matrix<dlib::rgb_pixel> dlibRGBImg;
-		    std::vector<dlib::matrix<dlib::rgb_pixel>> images;
-		    dlib::rectangle det;
-		    long frameCnt = 0;
-		    bool vid_read = vid.read(cvBGRImg);
-		    while (vid_read || !images.empty())
+		    auto read_frame = [&](dlib::matrix<dlib::rgb_pixel>& img) -> bool
 		    {
-			    if (vid_read)
+			    profiler::Timer timer("decode");
+			    if (decoder)
 			    {
+				    if (!decoder->read(img))
+					    return false;
+			    }
+			    else
+			    {
+				    if (!vid.read(cvBGRImg))
+					    return false;
 				    // Copy image to correct format
-				    dlib::assign_image(dlibRGBImg, dlib::cv_image<dlib::bgr_pixel>(cvBGRImg));
-				    images.push_back(std::move(dlibRGBImg));
-				    vid_read = vid.read(cvBGRImg);
-
-				    if (images.size() < 15)
-					    continue;
+				    dlib::assign_image(img, dlib::cv_image<dlib::bgr_pixel>(cvBGRImg));
 			    }
+			    profiler::add_frames(1);
+			    return true;
+		    };
 
-			    // Get detections
-			    auto detectionList = net(images);
+		    VideoFaceDetector face_detector(detector, options.keyframe_interval, options.min_tracking_confidence, options.roi_scale);
+		    std::vector<dlib::matrix<dlib::rgb_pixel>> images(batch_size);
+		    std::vector<dlib::rectangle> faces;
+		    long frameCnt = 0;
+		    bool vid_read = true;
+		    while (vid_read)
+		    {
+			    // Read next batch of frames (the image buffers are reused)
+			    size_t n = 0;
+			    while (n < batch_size && (vid_read = read_frame(images[n])))
+				    ++n;
+			    if (n == 0)
+				    break;
+			    if (n < images.size())
+				    images.resize(n);
 
-			    for (auto&& dets : detectionList)
+			    // Get detections
+			    std::chrono::steady_clock::time_point detection_start = std::chrono::steady_clock::now();
 			    {
-				    if (dets.empty())
-				    {
-					    det = dlib::rectangle();
-				    }
-				    else
-				    {
-					    // Sort detection scores in ascending order
-					    std::sort(dets.begin(), dets.end(), [](const mmod_rect& left, const mmod_rect& right) {return(right.detection_confidence < left.detection_confidence); });
-					    // The first detection has the highest score.
-					    det = dets.at(0).rect;
-				    }
+				    profiler::Timer timer("face_detection");
+				    face_detector.detect(images, faces);
+			    }
+			    detectionMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - detection_start).count();
 
+			    for (const auto& det : faces)
+			    {
 				    // Write detection to file (x, y, width, height)
-				    detFile << nrVid << "," << frameCnt << "," << det.left() << "," << det.top() << "," << det.width() << "," << det.height() << std::endl;
+				    const int32_t box[4] = { int32_t(det.left()), int32_t(det.top()), int32_t(det.width()), int32_t(det.height()) };
+				    detVideo.append(0, box);
 
     // 				win.clear_overlay();
     // 				win.set_image(dlibBGRImg);
@@ -108,30 +180,45 @@ void detectFace(const std::string& exdata_dir, const std::string& train_or_val_o
 
 				    frameCnt++;
 			    }
-			    images.clear();
 		    }
-		    std::cout << " with " << frameCnt << "frames. Done." << std::endl;
-		    ++nrVid;
+		    nrFrames += frameCnt;
+		    nrDetectorFrames += face_detector.num_detector_frames();
+		    nrTrackedFrames += face_detector.num_tracked_frames();
+		    nrRoiFrames += face_detector.num_roi_frames();
+		    std::lock_guard<std::mutex> lock(misc::output_mutex());
+		    std::cout << "Video " << nrVid+1 << " with " << frameCnt << " frames (" << face_detector.num_detector_frames() << " detected (" << face_detector.num_roi_frames() << " in ROI), " << face_detector.num_tracked_frames() << " tracked). Done." << std::endl;
 		}
 		catch(const std::exception& e)
 		{
+		    std::lock_guard<std::mutex> lock(misc::output_mutex());
 		    std::cout << "\n-----------------------------------------------------------------------\n";
 		    std::cout << "Error at vid nr: " << nrVid << std::endl;
 		    std::cout << e.what() << std::endl;
 		    std::cout << "-----------------------------------------------------------------------\n\n";
-		    ++nrVid;
 		    ++nrError;
+		    failed = true;
 		}
 		catch(...)
 		{
+		    std::lock_guard<std::mutex> lock(misc::output_mutex());
 		    std::cout << "\n-----------------------------------------------------------------------\n";
 		    std::cout << "Error at vid nr: " << nrVid << std::endl;
 		    std::cout << "-----------------------------------------------------------------------\n\n";
-		    ++nrVid;
 		    ++nrError;
+		    failed = true;
 		}
-	}
+		// Detections are written in video order, including those of a video that failed halfway (which is processed again by the next run)
+		detWriter.write(nrVid, std::move(detVideo));
+		if (!failed)
+			checkpoint.set_done(nrVid, video_keys[nrVid]);
+	});
 	
 	std::cout << "Finished. Number of Errors: " << nrError << std::endl;
-	detFile.close();
+	std::cout << "Frames processed by face detector: " << nrDetectorFrames << " (" << nrRoiFrames << " in ROI), by tracker: " << nrTrackedFrames << std::endl;
+	// Detection throughput per thread (excluding decoding) and overall throughput of this stage
+	double seconds_detection = detectionMicroseconds / 1e6;
+	double seconds_total = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_start).count() / 1e3;
+	std::cout << "Face detector " << detectors[0]->get_name() << ": " << (seconds_detection > 0 ? nrFrames / seconds_detection : 0.0) << " frames/sec per thread (detection only), "
+		  << (seconds_total > 0 ? nrFrames / seconds_total : 0.0) << " frames/sec overall" << std::endl;
+	CV_Assert(detWriter.close());
 }
@@ -0,0 +1,117 @@
+// Authors: Frerk Saxen and Philipp Werner (Frerk.Saxen@ovgu.de, Philipp.Werner@ovgu.de)
+// License: BSD 2-Clause "Simplified" License (see LICENSE file in root directory)
+
+/* Single pass alternative to detectFace(), detectAUsOld(), and recognizeFaces().
+ * Each video is decoded only once. Every frame is passed through face detection, landmark detection, face registration,
+ * AU intensity estimation, and (for every 4th of the first 200 frames) face chip extraction for face recognition.
+ * The written files (xxx_facedet.bin, xxx_AUOld.bin, xxx_landmarks.bin, xxx_face_recognition.txt) are the same as those of the separate stages.
+ * The videos are processed by FacialActivityExtractor, this function only writes its results.
+ */
+
+#include <opencv2/core/core.hpp>
+
+#include <iostream>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <dlib/image_processing.h>
+
+#include "misc.hpp"
+#include "LandmarkCache.hpp"
+#include "ResultStore.hpp"
+#include "ExtractionOptions.hpp"
+#include "FacialActivityExtractor.hpp"
+#include "Profiler.hpp"
+
+using namespace dlib;
+using namespace std;
+
+void clusterFaces(const std::vector<std::vector<matrix<float, 0, 1>>>& face_descriptors, const std::vector<matrix<rgb_pixel>>& first_frame, const std::string& filename_face_recognition);
+
+void extractFeaturesFused(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options)
+{
+	std::string filename_list_filename = exdata_dir + train_or_val_or_test + "_filenames.txt";
+	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.bin";
+	std::string filename_AUsOld = exdata_dir + train_or_val_or_test + "_AUOld.bin";
+	std::string filename_face_recognition = exdata_dir + train_or_val_or_test + "_face_recognition.txt";
+	std::string filename_landmarks = exdata_dir + train_or_val_or_test + "_landmarks.bin";
+
+	std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
+
+	// The files of the separate stages are replaced, so their checkpoints are no longer valid
+	for (const std::string stage : {"_facedet", "_AUOld", "_face_recognition"})
+		std::remove((exdata_dir + train_or_val_or_test + stage + ".checkpoint").c_str());
+
+	std::vector<std::string> filename_list;
+	misc::read_filename_list(filename_list_filename, filename_list);
+
+	// Load all models, one copy per thread
+	const long num_jobs = std::max(options.jobs, 1L);
+	std::vector<FacialActivityExtractor> extractors;
+	extractors.reserve(num_jobs);
+	extractors.emplace_back(exdata_dir, options);
+	for (long job_id = 1; job_id < num_jobs; ++job_id)
+		extractors.push_back(extractors[0]);
+
+	// Open detection filename
+	ResultStoreWriter detWriter(filename_face_detection, filename_list.size(), face_detection_columns());
+	DLIB_CASSERT(detWriter.is_open(), "Could not open filename: " << filename_face_detection << " for writing.\n");
+
+	LandmarkCacheWriter landmark_writer(filename_landmarks, filename_list.size(), extractors[0].num_landmarks());
+	DLIB_CASSERT(landmark_writer.is_open(), "Could not open filename: " << filename_landmarks << " for writing.\n");
+
+	const std::vector<ResultColumn> AU_columns = au_columns(extractors[0].num_AUs());
+	ResultStoreWriter AU_writer(filename_AUsOld, filename_list.size(), AU_columns);
+	DLIB_CASSERT(AU_writer.is_open(), "Could not open filename: " << filename_AUsOld << " for writing.\n");
+
+	std::vector<std::vector<FacialActivity::descriptor_type>> face_descriptors(filename_list.size());
+	std::vector<matrix<rgb_pixel>> first_frame(filename_list.size());
+
+	misc::parallel_for_videos(options.jobs, filename_list.size(), [&](long job_id, long vid_id)
+	{
+	      profiler::VideoScope video_scope(vid_id);
+	      const auto vid_filename = filename_list.at(vid_id);
+
+	      misc::print_progress(time_start, vid_id, filename_list.size(), vid_filename);
+
+	      FacialActivity activity = extractors.at(job_id).process_video(vid_filename);
+	      DLIB_CASSERT(!activity.face_descriptors.empty(), "No frames in video " << vid_filename);
+
+	      ResultVideo det_video(face_detection_columns());
+	      for (const dlib::rectangle& det : activity.faces)
+	      {
+		      // Detection as (x, y, width, height)
+		      const int32_t box[4] = { int32_t(det.left()), int32_t(det.top()), int32_t(det.width()), int32_t(det.height()) };
+		      det_video.append(0, box);
+	      }
+	      std::vector<int16_t> video_landmarks;
+	      for (const dlib::full_object_detection& shape : activity.landmarks)
+		      LandmarkCacheWriter::append(shape, video_landmarks);
+	      ResultVideo AU_video(AU_columns);
+	      for (int row = 0; row < activity.AU_intensities.rows; ++row)
+		      AU_video.append(0, activity.AU_intensities.ptr<float>(row));
+
+	      // Never waits: the results are written in video order, so they are only buffered while earlier videos are missing.
+	      // If this video closes the gap, the time includes writing its results and the buffered results of later videos.
+	      profiler::Timer write_timer("write");
+	      detWriter.write(vid_id, std::move(det_video));
+	      landmark_writer.write(vid_id, std::move(video_landmarks));
+	      AU_writer.write(vid_id, std::move(AU_video));
+	      write_timer.stop();
+
+	      first_frame.at(vid_id) = std::move(activity.first_face);
+	      face_descriptors.at(vid_id) = std::move(activity.face_descriptors);
+	});
+	DLIB_CASSERT(detWriter.close(), "Error writing face detections to " << filename_face_detection);
+	DLIB_CASSERT(landmark_writer.close(), "Error writing landmarks to " << filename_landmarks);
+	DLIB_CASSERT(AU_writer.close(), "Error writing AUs to " << filename_AUsOld);
+
+	clusterFaces(face_descriptors, first_frame, filename_face_recognition);
+
+	return;
+}
@@ -4,16 +4,28 @@
 /* This is the main execution entry for extracting all necessary features for training, validation, and testing.
  * After providing the necessary arguments (see function help() ), the following functions will be executed in order:
  * 1. createFileNameList(): A filename list txt file will be created in the exdata directory that lists all video filenames in the dataset folder (given as argument).
- * 2. detectFace(): For each frame of all videos the face will be detected and the results will be stored in a xxx_facedet.txt file.
- * 3. detectAUsOld(): We extract 7 different facial action units for each frame and save the results to another txt file.
+ * 2. detectFace(): For each frame of all videos the face will be detected and the results will be stored in a xxx_facedet.bin file.
+ * 3. detectAUsOld(): We extract 7 different facial action units for each frame and save the results to another binary file (see ResultStore.hpp).
  * 4. recognizeFaces(): We cluster similar faces in the dataset to allow intra-personal classification.
+ * With --fused, steps 2-4 are replaced by extractFeaturesFused(), which decodes every video only once and writes the same files.
+ * 5. export_result_csv(): The binary face detection and AU files are exported as xxx_facedet.txt and xxx_AUOld.txt for matlab.
+ * With --profile / --trace, the run time of the steps is measured per video and per section (see Profiler.hpp).
  */
 #include <iostream>
+#include <cstdlib>
+#include <stdexcept>
 #include <experimental/filesystem>
+#include "ExtractionOptions.hpp"
+#include "Profiler.hpp"
 void createFileNameList(const std::string& dataset_dir, const std::string& exdata_dir, const std::string& train_or_val_or_test);
-void detectFace(const std::string& exdata_dir, const std::string& train_or_val_or_test);
-void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val_or_test);
-void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_val_or_test);
+void detectFace(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options);
+void detectAUsOld(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options);
+void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options);
+void extractFeaturesFused(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options);
+bool export_result_csv(const std::string& store_filename, const std::string& csv_filename);
+void calibrateAUQuantization(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options);
+bool parseOptions(int argc, char **argv, int first_arg, ExtractionOptions& options);
+void writeProfile(const ExtractionOptions& options);
 int help();
 
 
@@ -21,7 +33,8 @@ namespace fs = std::experimental::filesystem;
 
 int main(int argc, char **argv) 
 {
-	if(argc != 4)
+	ExtractionOptions options;
+	if(argc < 4 || !parseOptions(argc, argv, 4, options))
 	      return help();
 	
 	std::string dataset_dir = std::string(argv[1]);
@@ -37,23 +50,75 @@ int main(int argc, char **argv)
 		dataset_dir.push_back('/');
 	if(exdata_dir.back() != '/')
 		exdata_dir.push_back('/');
+	if(!options.profile_file.empty() || !options.trace_file.empty())
+		profiler::enable(!options.trace_file.empty());
 	
 	try
 	{
 		std::cout << "1. Create Filename list from dataset folder ..." << std::endl;
 		createFileNameList(dataset_dir, exdata_dir, train_or_val_or_test);
-		std::cout << "Done.\n2. Detect faces in each video ..." << std::endl;
-		detectFace(exdata_dir, train_or_val_or_test);
-		std::cout << "Done.\n3. Extract Action Units in each frame ..." << std::endl;
-		detectAUsOld(exdata_dir, train_or_val_or_test);
-		std::cout << "Done.\n4. Recognize faces ... " << std::endl;
-		recognizeFaces(exdata_dir, train_or_val_or_test);
+		if(options.au_calibrate)
+		{
+			// Needs the face detections, the landmarks of a previous run are used if available
+			if(!fs::exists(exdata_dir + train_or_val_or_test + "_facedet.bin"))
+			{
+				std::cout << "Done.\n2. Detect faces in each video ..." << std::endl;
+				profiler::StageScope stage("detectFace");
+				detectFace(exdata_dir, train_or_val_or_test, options);
+			}
+			std::cout << "Done.\nCompare quantized and float AU estimation ..." << std::endl;
+			{
+				profiler::StageScope stage("calibrateAUQuantization");
+				calibrateAUQuantization(exdata_dir, train_or_val_or_test, options);
+			}
+			writeProfile(options);
+			std::cout << "Done." << std::endl;
+			return 0;
+		}
+		if(options.fused)
+		{
+			std::cout << "Done.\n2.-4. Detect faces, extract Action Units, and recognize faces in a single pass ..." << std::endl;
+			profiler::StageScope stage("extractFeaturesFused");
+			extractFeaturesFused(exdata_dir, train_or_val_or_test, options);
+		}
+		else
+		{
+			std::cout << "Done.\n2. Detect faces in each video ..." << std::endl;
+			{
+				profiler::StageScope stage("detectFace");
+				detectFace(exdata_dir, train_or_val_or_test, options);
+			}
+			std::cout << "Done.\n3. Extract Action Units in each frame ..." << std::endl;
+			{
+				profiler::StageScope stage("detectAUsOld");
+				detectAUsOld(exdata_dir, train_or_val_or_test, options);
+			}
+			std::cout << "Done.\n4. Recognize faces ... " << std::endl;
+			{
+				profiler::StageScope stage("recognizeFaces");
+				recognizeFaces(exdata_dir, train_or_val_or_test, options);
+			}
+		}
+		if(options.export_csv)
+		{
+			std::cout << "Done.\n5. Export results as text files for matlab ..." << std::endl;
+			profiler::StageScope stage("export_result_csv");
+			for(const std::string name : {"_facedet", "_AUOld"})
+			{
+				const std::string filename = exdata_dir + train_or_val_or_test + name;
+				if(!export_result_csv(filename + ".bin", filename + ".txt"))
+					throw std::runtime_error("Error exporting " + filename + ".bin to " + filename + ".txt");
+			}
+		}
+		writeProfile(options);
  		std::cout << "Done. \nYou are now finished with the C++ part. Please execute the main.m file in the matlab folder with matlab R2015a or newer.\nPress Enter to continue." << std::endl;
 		std::cin.get();
 	}
 	catch (std::exception& e)
 	{
 		std::cout << e.what() << std::endl;
+		// The profile of the steps until the error
+		writeProfile(options);
 		std::cout << "Caution. Errors occured. You can not proceed with matlab. Please contact the authors if you cannot resolve the issues. Press enter to terminate." << std::endl;
 		std::cin.get();
 		return -1;
@@ -61,13 +126,48 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+void writeProfile(const ExtractionOptions& options)
+{
+	if(!options.profile_file.empty())
+	{
+		if(profiler::write_summary(options.profile_file))
+			std::cout << "Profile written to " << options.profile_file << std::endl;
+		else
+			std::cout << "Error: Cannot write profile to " << options.profile_file << std::endl;
+	}
+	if(!options.trace_file.empty())
+	{
+		if(profiler::write_trace(options.trace_file))
+			std::cout << "Trace written to " << options.trace_file << " (open with chrome://tracing)" << std::endl;
+		else
+			std::cout << "Error: Cannot write trace to " << options.trace_file << std::endl;
+	}
+}
+
 int help()
 {
 	std::cout << std::endl;
-	std::cout << "usage: NIT-ICCV17Challenge <dataset_dir> <exdata_dir> <train_or_val_or_test>" << std::endl;
+	std::cout << "usage: NIT-ICCV17Challenge <dataset_dir> <exdata_dir> <train_or_val_or_test> [options]" << std::endl;
 	std::cout << "dataset_dir: Please provide the full folder name of the (training, validation, or testing) video dataset. E.g. /home/user/iccvdataset/test/" << std::endl;
 	std::cout << "exdata_dir: This program extracts the features for the matlab traning and testing procedure. Please provide a folder for this data. E.g. /home/user/iccvdataset/exdata/" << std::endl;
 	std::cout << "train_or_val_or_test: Since we extract training, validation, or testing data, please provide a postfix to identify with either {train, val, test} depending on the execution." << std::endl;
+	std::cout << "options:" << std::endl;
+	std::cout << "  --fused: Decode each video only once and run face detection, action unit estimation, and face recognition in a single pass. The output files are the same as without this option." << std::endl;
+	std::cout << "  --jobs N: Process N videos in parallel (default: 1). The output files are the same for any N." << std::endl;
+	std::cout << "  --detector {cnn, hog}: Face detector backend. cnn (default) is the MMOD network we used for our submission, it needs CUDA to be fast. hog is dlib's HOG detector, which is fast on the CPU but less robust. The frames/sec of the detector are printed after face detection." << std::endl;
+	std::cout << "  --async-decode: Face detection decodes the video in a separate thread, so decoding and detection run concurrently." << std::endl;
+	std::cout << "  --track K: Run the face detector only on every K-th frame and track the face with a correlation tracker in between (default: 1, no tracking). The detections differ slightly from those of the face detector." << std::endl;
+	std::cout << "  --track-confidence T: With --track, run the face detector also when the tracking confidence drops below T (default: 7)." << std::endl;
+	std::cout << "  --roi S: Run the face detector on a region of S times the size of the previous face box first (e.g. 2) and only search the full frame if no face is found there." << std::endl;
+	std::cout << "  --affine-svd: Face registration estimates the affine transform with the SVD solver (as in our submission) instead of the equivalent, faster closed form solution." << std::endl;
+	std::cout << "  --gray-warp: Face registration for AU estimation converts only the face region to grayscale and warps a single channel instead of the color image. Faster, but the AU intensities differ slightly from our submission." << std::endl;
+	std::cout << "  --au-unfolded: AU estimation normalizes the features before the regression (as in our submission) instead of folding the normalization into the regression weights (faster, differs only by float rounding)." << std::endl;
+	std::cout << "  --au-quantized {int16, int8}: AU estimation uses integer LBP histograms and quantized regression weights. The AU intensities differ slightly from the float model (see --au-calibrate). Cannot be combined with --au-unfolded." << std::endl;
+	std::cout << "  --recompute: Process all videos again. By default, steps 2-4 skip the videos whose file, inputs, models, and settings did not change since the last (possibly aborted) run (see xxx_*.checkpoint). --fused always processes all videos." << std::endl;
+	std::cout << "  --no-csv: Do not export the binary face detection and AU files as text files (xxx_facedet.txt, xxx_AUOld.txt). The matlab part needs the text files." << std::endl;
+	std::cout << "  --au-calibrate: Instead of the feature extraction, estimate the AUs of the given videos with the float and the quantized models and print the maximum deviation of the AU intensities. Uses the face detections and landmarks of a previous run (faces are detected if needed)." << std::endl;
+	std::cout << "  --profile FILE: Measure the run time of the steps, videos, and their sections (decoding, face detection, landmarks, registration, AU estimation, face recognition) and write frames/sec and latency percentiles (p50, p95, p99) as JSON to FILE." << std::endl;
+	std::cout << "  --trace FILE: Write all measured sections as Chrome trace (open FILE with chrome://tracing) to see the timeline of the parallel jobs. Needs memory for each section of each frame." << std::endl;
 	std::cout << std::endl;
 	return -1;
 }
\ No newline at end of file
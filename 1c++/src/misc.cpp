@@ -9,6 +9,12 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <dlib/string.h>
 
 namespace misc
 {
@@ -118,4 +124,78 @@ namespace misc
 	    return;
     }
     
+    std::mutex& output_mutex()
+    {
+	    static std::mutex mutex;
+	    return mutex;
+    }
+
+    void print_progress(const std::chrono::steady_clock::time_point& time_start, long vid_id, long num_videos, const std::string& filename)
+    {
+	    std::chrono::steady_clock::time_point time_end = std::chrono::steady_clock::now();
+	    int seconds_expired = std::chrono::duration_cast<std::chrono::seconds>(time_end - time_start).count();
+	    int minutes_left = vid_id == 0 ? 0 : seconds_expired * (static_cast<double>(num_videos - vid_id) / (double)vid_id / 60.0);
+
+	    std::lock_guard<std::mutex> lock(output_mutex());
+	    std::cout << dlib::rpad(dlib::cast_to_string(vid_id+1),3) << "/" << num_videos << ". Approx. " << dlib::rpad(dlib::cast_to_string(minutes_left), 3) << " minutes left. " << "Processing video: " << filename << std::endl;
+    }
+
+    void parallel_for_videos(long num_jobs, long num_videos, const std::function<void(long job_id, long vid_id)>& fn)
+    {
+	    if(num_jobs <= 1)
+	    {
+		for(long vid_id = 0; vid_id < num_videos; ++vid_id)
+		    fn(0, vid_id);
+		return;
+	    }
+
+	    // Videos are handed out through a shared counter. Compared to static partitioning this keeps all threads busy
+	    // regardless of the video lengths and the results arrive roughly in vid_id order.
+	    std::atomic<long> next_vid_id(0);
+	    std::atomic<bool> failed(false);
+	    std::exception_ptr error;
+	    std::mutex error_mutex;
+
+	    auto worker = [&](long job_id)
+	    {
+		for(long vid_id = next_vid_id++; vid_id < num_videos && !failed; vid_id = next_vid_id++)
+		{
+		    try
+		    {
+			fn(job_id, vid_id);
+		    }
+		    catch(...)
+		    {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if(!failed)
+			    error = std::current_exception();
+			failed = true;
+		    }
+		}
+	    };
+
+	    std::vector<std::thread> threads;
+	    for(long job_id = 0; job_id < num_jobs; ++job_id)
+		threads.emplace_back(worker, job_id);
+	    for(auto& t : threads)
+		t.join();
+
+	    if(error)
+		std::rethrow_exception(error);
+    }
+
+    void OrderedCommit::commit(long vid_id, std::function<void()> fn)
+    {
+	    std::lock_guard<std::mutex> lock(m_mutex);
+	    m_pending[vid_id] = std::move(fn);
+
+	    // Run all consecutive functions that are complete now
+	    auto it = m_pending.begin();
+	    while(it != m_pending.end() && it->first == m_next_vid_id)
+	    {
+		it->second();
+		it = m_pending.erase(it);
+		++m_next_vid_id;
+	    }
+    }
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include <iostream>
+#include <sstream>
 #include <chrono>
 #include <vector>
 #include <string>
@@ -24,45 +25,72 @@
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/image_processing/render_face_detections.h>
 
+#include <FaceBase/DlibNetworks.hpp>
 #include "misc.hpp"
+#include "LandmarkCache.hpp"
+#include "ResultStore.hpp"
+#include "Checkpoint.hpp"
+#include "ExtractionOptions.hpp"
+#include "FacialActivityExtractor.hpp"
+#include "Profiler.hpp"
 
 using namespace dlib;
 using namespace std;
 
-// ----------------- Face Recognition CNN Architecture --------------------------------------------
-template <template <int, template<typename>class, int, typename> class block, int N, template<typename>class BN, typename SUBNET>
-using residual = add_prev1<block<N, BN, 1, tag1<SUBNET>>>;
+using dlib_networks::face_rec_net_type;
 
-template <template <int, template<typename>class, int, typename> class block, int N, template<typename>class BN, typename SUBNET>
-using residual_down = add_prev2<avg_pool<2, 2, 2, 2, skip1<tag2<block<N, BN, 2, tag1<SUBNET>>>>>>;
-
-template <int N, template <typename> class BN, int stride, typename SUBNET>
-using block = BN<con<N, 3, 3, 1, 1, relu<BN<con<N, 3, 3, stride, stride, SUBNET>>>>>;
-
-template <int N, typename SUBNET> using ares = relu<residual<block, N, affine, SUBNET>>;
-template <int N, typename SUBNET> using ares_down = relu<residual_down<block, N, affine, SUBNET>>;
-
-template <typename SUBNET> using alevel0 = ares_down<256, SUBNET>;
-template <typename SUBNET> using alevel1 = ares<256, ares<256, ares_down<256, SUBNET>>>;
-template <typename SUBNET> using alevel2 = ares<128, ares<128, ares_down<128, SUBNET>>>;
-template <typename SUBNET> using alevel3 = ares<64, ares<64, ares<64, ares_down<64, SUBNET>>>>;
-template <typename SUBNET> using alevel4 = ares<32, ares<32, ares<32, SUBNET>>>;
-
-using face_rec_net_type = loss_metric<fc_no_bias<128, avg_pool_everything<
-	alevel0<
-	alevel1<
-	alevel2<
-	alevel3<
-	alevel4<
-	max_pool<3, 3, 2, 2, relu<affine<con<32, 7, 7, 2, 2,
-	input_rgb_image_sized<150>
-	>>>>>>>>>>>>;
+// Cluster the face descriptors of all videos into identities and write the cluster label of each video to filename_face_recognition.
+void clusterFaces(const std::vector<std::vector<matrix<float, 0, 1>>>& face_descriptors, const std::vector<matrix<rgb_pixel>>& first_frame, const std::string& filename_face_recognition)
+{
+	const long num_clusters = face_descriptors.size() / 12; // There are always 12 videos of the same person
+	
+ 	std::vector<unsigned long> labels = FacialActivityExtractor::cluster_identities(face_descriptors, num_clusters);
+	
+	
+	// Now let's display the face clustering results on the screen.  It hopefully
+	// correctly grouped all the faces. (Skipped if there is no display, e.g. on a server.)
+	try
+	{
+	    std::vector<image_window> win_clusters(num_clusters);
+	    for (size_t cluster_id = 0; cluster_id < num_clusters; ++cluster_id)
+	    {
+		std::vector<matrix<rgb_pixel>> temp;
+		for (size_t j = 0; j < labels.size(); ++j)
+		{
+		    if (cluster_id == labels[j])
+			temp.push_back(first_frame[j]);
+		}
+		win_clusters[cluster_id].set_title("face cluster " + cast_to_string(cluster_id));
+		win_clusters[cluster_id].set_image(tile_images(temp));
+	    }
+	}
+	catch (const dlib::gui_error&)
+	{
+	    std::cout << "No display available, the face clusters are not shown." << std::endl;
+	}
+	
+	// Open dest filename
+	std::ofstream idFile(filename_face_recognition);
+	DLIB_CASSERT(idFile.is_open());
+	DLIB_CASSERT(labels.size() == face_descriptors.size());
+	for(long vid_id = 0; vid_id < face_descriptors.size(); ++vid_id)
+	{
+		  idFile << vid_id << "," << labels[vid_id] << "\n";
+	}
+	idFile.close();
+//  	std::cin.get();
+	
+	return;
+}
 
-void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_val_or_test)
+void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_val_or_test, const ExtractionOptions& options)
 {
 	std::string filename_list_filename = exdata_dir + train_or_val_or_test + "_filenames.txt";
-	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.txt";
+	std::string filename_face_detection = exdata_dir + train_or_val_or_test + "_facedet.bin";
 	std::string filename_face_recognition = exdata_dir + train_or_val_or_test + "_face_recognition.txt";
+	std::string filename_landmarks = exdata_dir + train_or_val_or_test + "_landmarks.bin";
+	std::string filename_face_descriptors = exdata_dir + train_or_val_or_test + "_face_descriptors.dat";
+	std::string filename_checkpoint = exdata_dir + train_or_val_or_test + "_face_recognition.checkpoint";
 
 	
 	std::string shape_predictor_file = exdata_dir + "spd+all=cascade30+oversampling70+trees1500.dat";
@@ -77,11 +105,44 @@ void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_v
 	misc::read_filename_list(filename_list_filename, filename_list);
 
 	std::vector<std::vector<dlib::rectangle>> face_dets_list;
-	misc::read_face_detection(filename_face_detection, face_dets_list);
+	read_face_detections(filename_face_detection, face_dets_list);
 
 	
 	DLIB_CASSERT(filename_list.size() == face_dets_list.size(), "List size mismatch: \n\t filename_list.size(): " << filename_list.size() << "\n\t face_dets_list.size(): " << face_dets_list.size() << std::endl);
-	
+
+	typedef matrix<float, 0, 1> sample_type;
+	std::vector<std::vector<sample_type>> face_descriptors;
+	std::vector<matrix<rgb_pixel>> first_frame;
+
+	// Videos whose file, face detections, and models did not change since the last run are not processed again.
+	// Their face descriptors are taken from the previous run.
+	std::ostringstream models_key;
+	models_key << Checkpoint::content_key(shape_predictor_file) << ":" << Checkpoint::content_key(face_recognition_file);
+	Checkpoint checkpoint(filename_checkpoint, models_key.str(), !options.recompute);
+	const std::vector<std::string> video_keys = video_input_keys(filename_list, &face_dets_list);
+	try
+	{
+		dlib::deserialize(filename_face_descriptors) >> face_descriptors >> first_frame;
+	}
+	catch (const dlib::serialization_error&)
+	{
+	}
+	if (face_descriptors.size() != filename_list.size() || first_frame.size() != filename_list.size())
+	{
+		face_descriptors.assign(filename_list.size(), std::vector<sample_type>());
+		first_frame.assign(filename_list.size(), matrix<rgb_pixel>());
+	}
+	std::vector<bool> reused(filename_list.size());
+	for (size_t vid_id = 0; vid_id < filename_list.size(); ++vid_id)
+		reused[vid_id] = checkpoint.is_done(vid_id, video_keys[vid_id]) && !face_descriptors[vid_id].empty();
+	const long num_reused = std::count(reused.begin(), reused.end(), true);
+	std::cout << num_reused << " of " << filename_list.size() << " videos are unchanged since the last run." << std::endl;
+	if (num_reused == static_cast<long>(filename_list.size()))
+	{
+		clusterFaces(face_descriptors, first_frame, filename_face_recognition);
+		return;
+	}
+	DLIB_CASSERT(checkpoint.start(video_keys, reused), "Could not write " << filename_checkpoint);
 
 	shape_predictor sp;
 	deserialize(shape_predictor_file) >> sp;
@@ -91,30 +152,54 @@ void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_v
 	
 	long nrError = 0;
 
-	matrix<dlib::rgb_pixel> img;
-	cv::Mat cvImage;
-	typedef matrix<float, 0, 1> sample_type;
-	std::vector<std::vector<sample_type>> face_descriptors;
-	std::vector<matrix<rgb_pixel>> first_frame;
+	// Use the landmarks saved by detectAUsOld() instead of running the shape predictor again (if available and valid)
+	LandmarkCacheReader landmark_reader(filename_landmarks);
+	const bool use_landmark_cache = landmark_reader.is_open() && landmark_reader.num_videos() == filename_list.size() && landmark_reader.num_points() == sp.num_parts();
+	if (use_landmark_cache)
+		std::cout << "Using landmarks from " << filename_landmarks << std::endl;
+	else
+		std::cout << "No valid landmark file " << filename_landmarks << " found. Detecting landmarks ..." << std::endl;
 
-	for(long vid_id = 0; vid_id < filename_list.size(); ++vid_id)
+	// One copy of each model per thread
+	const long num_jobs = std::max(options.jobs, 1L);
+	std::vector<shape_predictor> sps(num_jobs, sp);
+	std::vector<face_rec_net_type> face_rec_nets(num_jobs, face_rec_net);
+
+	misc::parallel_for_videos(options.jobs, filename_list.size(), [&](long job_id, long vid_id)
 	{
+	      if (reused[vid_id])
+		      return;
+
+	      profiler::VideoScope video_scope(vid_id);
 	      const auto vid_filename = filename_list.at(vid_id);
-	      
-	      std::chrono::steady_clock::time_point time_end = std::chrono::steady_clock::now();
-	      int seconds_expired = std::chrono::duration_cast<std::chrono::seconds>(time_end - time_start).count();
-	      int minutes_left = vid_id == 0 ? 0 : seconds_expired * (static_cast<double>(filename_list.size() - vid_id) / (double)vid_id / 60.0);
-	      std::cout << rpad(cast_to_string(vid_id+1),3) << "/" << filename_list.size() << ". Approx. " << rpad(cast_to_string(minutes_left), 3) << " minutes left. " << "Processing video: " << vid_filename << std::endl;
+	      shape_predictor& sp = sps.at(job_id);
+	      face_rec_net_type& face_rec_net = face_rec_nets.at(job_id);
+
+	      matrix<dlib::rgb_pixel> img;
+	      cv::Mat cvImage;
+
+	      misc::print_progress(time_start, vid_id, filename_list.size(), vid_filename);
 	  
 	      cv::VideoCapture vid(vid_filename);
 	      DLIB_CASSERT(vid.isOpened(), "Cannot open video filename : " << vid_filename);
 	      
 	      const std::vector<dlib::rectangle>& face_dets = face_dets_list.at(vid_id);
+	      std::vector<int16_t> video_landmarks;
+	      const bool video_landmarks_cached = use_landmark_cache && landmark_reader.num_frames(vid_id) == face_dets.size() && landmark_reader.read(vid_id, video_landmarks);
 	      std::vector<matrix<rgb_pixel>> faces;
 	      matrix<rgb_pixel> face_chip;
 	      
+	      auto read_frame = [&]() -> bool
+	      {
+		      profiler::Timer timer("decode");
+		      if (!vid.read(cvImage))
+			      return false;
+		      profiler::add_frames(1);
+		      return true;
+	      };
+
 	      long frame_no = 0;
-	      while (vid.read(cvImage) && frame_no / 4.0 < max_frames)
+	      while (read_frame() && frame_no / 4.0 < max_frames)
 	      {
 		      // Take every 4th frame
 		      if(frame_no % 4 != 0)
@@ -129,65 +214,31 @@ void recognizeFaces(const std::string& exdata_dir, const std::string& train_or_v
 		      const auto& face_det = face_dets.at(frame_no);
 		      
 		      // Get landmarks and face chip
-		      auto shape = sp(img, face_det);
+		      profiler::Timer sp_timer(video_landmarks_cached ? "landmark_cache" : "shape_predictor");
+		      auto shape = video_landmarks_cached ? landmark_reader.get_shape(video_landmarks, frame_no, face_det) : sp(img, face_det);
+		      sp_timer.stop();
+		      profiler::Timer chip_timer("face_chip");
 		      auto face_details = get_face_chip_details(shape, 150, 0.25);
 		      extract_image_chip(img, face_details, face_chip); //, 150, 0.25
+		      chip_timer.stop();
  		      faces.push_back(move(face_chip));
 		      
 		      ++frame_no;
 	      }
-	      first_frame.push_back(faces.at(0));
+	      first_frame.at(vid_id) = faces.at(0);
 	      
 	      // Perform face recognition
-	      face_descriptors.push_back(face_rec_net(faces));
-	}
-	
-// 	dlib::deserialize(exdata_dir + "train_face_descriptors.dat") >> face_descriptors >> first_frame;
-	
-	
-	typedef std::vector<sample_type> vec_sample_type;
+	      profiler::Timer rec_timer("face_recognition");
+	      face_descriptors.at(vid_id) = face_rec_net(faces);
+	});
 	
-	const long num_clusters = filename_list.size() / 12; // There are always 12 videos of the same person
+	// The descriptors are saved for the next run, the videos are recorded in the checkpoint afterwards
+	dlib::serialize(filename_face_descriptors) << face_descriptors << first_frame;
+	for (size_t vid_id = 0; vid_id < filename_list.size(); ++vid_id)
+		if (!reused[vid_id])
+			checkpoint.set_done(vid_id, video_keys[vid_id]);
 	
-	auto dist_function = [](const vec_sample_type& a, const vec_sample_type&b)
-	{
-		std::vector<double> dists;
-		for (size_t i = 0; i < a.size(); ++i)
-		    for (size_t j = 0; j < b.size(); ++j)
-			dists.push_back(length(a[i]-b[j]));
-		std::sort(dists.begin(),dists.end());
- 		double median = dists.at(dists.size() / 2);
-		return 1.0 / (median + 0.00001);
-	};
-	
- 	std::vector<unsigned long> labels = spectral_cluster(dist_function, face_descriptors, num_clusters);
-	
-	
-	// Now let's display the face clustering results on the screen.  It hopefully
-	// correctly grouped all the faces. 
-	std::vector<image_window> win_clusters(num_clusters);
-	for (size_t cluster_id = 0; cluster_id < num_clusters; ++cluster_id)
-	{
-	    std::vector<matrix<rgb_pixel>> temp;
-	    for (size_t j = 0; j < labels.size(); ++j)
-	    {
-		if (cluster_id == labels[j])
-		    temp.push_back(first_frame[j]);
-	    }
-	    win_clusters[cluster_id].set_title("face cluster " + cast_to_string(cluster_id));
-	    win_clusters[cluster_id].set_image(tile_images(temp));
-	}
-	
-	// Open dest filename
-	std::ofstream idFile(filename_face_recognition);
-	DLIB_CASSERT(idFile.is_open());
-	DLIB_CASSERT(labels.size() == filename_list.size());
-	for(long vid_id = 0; vid_id < filename_list.size(); ++vid_id)
-	{
-		  idFile << vid_id << "," << labels[vid_id] << "\n";
-	}
-	idFile.close();
-//  	std::cin.get();
+	clusterFaces(face_descriptors, first_frame, filename_face_recognition);
 	
 	return;
 }
\ No newline at end of file